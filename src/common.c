@@ -63,12 +63,16 @@ EXTERN void get_token_text(char *op, int tk)
 ////////////////////
 
 // Return number of bytes in 'cnt' utf8 codepoints
-EXTERN int bytesinutf8(char *str, size_t len, size_t cnt)
+EXTERN size_t bytesinutf8(char *str, size_t len, size_t cnt)
 {
   if (FLAG(b)) return cnt;
   unsigned wch;
   char *lim = str + len, *s0 = str;
   while (cnt-- && str < lim) {
+    if (*(unsigned char *)str < 128) {
+      str++;
+      continue;
+    }
     int r = utf8towc(&wch, str, lim - str);
     str += r > 0 ? r : 1;
   }
@@ -76,10 +80,10 @@ EXTERN int bytesinutf8(char *str, size_t len, size_t cnt)
 }
 
 // Return number of utf8 codepoints in str
-EXTERN int utf8cnt(char *str, size_t len)
+EXTERN size_t utf8cnt(char *str, size_t len)
 {
   unsigned wch;
-  int cnt = 0;
+  size_t cnt = 0;
   char *lim;
   if (!len || FLAG(b)) return len;
   for (lim = str + len; str < lim; cnt++) {
@@ -89,6 +93,39 @@ EXTERN int utf8cnt(char *str, size_t len)
   return cnt;
 }
 
+// Process backslash escapes in s, in place; return s. For a regex
+// (is_regex), escapes other than those of awk strings are left for regcomp().
+EXTERN char *escape_str(char *s, int is_regex)
+{
+  char *p, *escapes = is_regex ? "abfnrtv\"/" : "\\abfnrtv\"/";
+  // FIXME TODO should / be in there?
+  char *s0 = s, *to = s;
+  while ((*to = *s)) {
+    if (*s != '\\') { to++, s++;
+    } else if ((p = strchr(escapes, *++s))) {
+      // checking char after \ for known escapes
+      int c = (is_regex?"\a\b\f\n\r\t\v\"/":"\\\a\b\f\n\r\t\v\"/")[p-escapes];
+      if (c) *to = c, s++;  // else final backslash
+      to++;
+    } else if ('0' <= *s && *s <= '9') {
+      int k, c = *s++ - '0';
+      for (k = 0; k < 2 && '0' <= *s && *s <= '9'; k++)
+        c = c * 8 + *s++ - '0';
+      *to++ = c;
+    } else if (*s == 'x') {
+      if (isxdigit(s[1])) {
+        int c = hexval(*++s);
+        if (isxdigit(s[1])) c = c * 16 + hexval(*++s);
+        *to++ = c, s++;
+      }
+    } else {
+      if (is_regex) *to++ = '\\';
+      *to++ = *s++;
+    }
+  }
+  return s0;
+}
+
 ////////////////////
 ////   zlist
 ////////////////////
@@ -186,11 +223,6 @@ EXTERN struct zstring *zstring_update(struct zstring *to, size_t at, char *s, si
   return zstring_modify(to, at, s, n);
 }
 
-EXTERN struct zstring *zstring_copy(struct zstring *to, struct zstring *from)
-{
-  return zstring_update(to, 0, from->str, from->size);
-}
-
 EXTERN struct zstring *zstring_extend(struct zstring *to, struct zstring *from)
 {
   return zstring_update(to, to->size, from->str, from->size);
@@ -246,13 +278,6 @@ EXTERN void zvalue_copy(struct zvalue *to, struct zvalue *from)
   }
 }
 
-EXTERN void zvalue_dup_zstring(struct zvalue *v)
-{
-  struct zstring *z = new_zstring(v->u.vst->str, v->u.vst->size);
-  zstring_release(&v->u.vst);
-  v->u.vst = z;
-}
-
 ////////////////////
 ////   zmap (array) implementation
 ////////////////////
@@ -318,6 +343,7 @@ static void zmap_init(struct zmap *m)
   m->limit = INIT_SIZE * 8 / 10;
   m->count = 0;
   m->deleted = 0;
+  m->split_cnt = 0;
   zlist_init(&m->slot, sizeof(struct zmap_slot));
 }
 
@@ -385,11 +411,30 @@ EXTERN struct zmap_slot *zmap_find_or_insert_key(struct zmap *m, struct zstring
   struct zmap_slot zs = ZMSLOTINIT(hash, key, (struct zvalue)ZVINIT(0, 0.0, 0));
   zstring_incr_refcnt(key);
   int n = zlist_append(&m->slot, &zs);
-  m->count++;
+  if (m->hash[probe] < 0) m->deleted--;   // reusing a deleted entry
+  else m->count++;
   m->hash[probe] = n + 1;
+  m->split_cnt = 0;
   return &MAPSLOT[n];
 }
 
+// Delete all but the first n slots, which must be the most recently
+// inserted; used to shrink the elements of a reused split() array.
+EXTERN void zmap_truncate(struct zmap *m, int n)
+{
+  int hash, probe;
+  for (struct zmap_slot *p = &MAPSLOT[n]; p < &MAPSLOT[zlist_len(&m->slot)]; p++) {
+    if (!p->key) continue;
+    find_mapslot(m, p->key, &hash, &probe);
+    m->hash[probe] = -1;
+    m->deleted++;
+    zstring_release(&p->key);
+    zvalue_release_zstring(&p->val);
+  }
+  m->slot.avail = m->slot.base + n * m->slot.size;
+  m->split_cnt = 0;
+}
+
 EXTERN void zmap_delete(struct zmap *m, struct zstring *key)
 {
   int hash, probe;
@@ -398,4 +443,25 @@ EXTERN void zmap_delete(struct zmap *m, struct zstring *key)
   zstring_release(&MAPSLOT[m->hash[probe] - 1].key);
   m->hash[probe] = -1;
   m->deleted++;
+  m->split_cnt = 0;
+}
+
+// File table: each file or command name used in an i/o redirection gets a
+// fixed slot number, kept in TT.file_map as the value for the name. The
+// open zfile for the name (if any) is in FILESLOT[slot].zfp. Slots are never
+// reused, so a constant name can be given its slot at compile time.
+EXTERN int file_slot(struct zstring *name)
+{
+  struct zmap *m = TT.file_map;
+  if (!m) {
+    m = TT.file_map = xmalloc(sizeof(*m));
+    zmap_init(m);
+    zlist_init(&TT.file_slots, sizeof(struct file_slot));
+  }
+  struct zmap_slot *x = zmap_find_or_insert_key(m, name);
+  if (!x->val.flags) {
+    struct file_slot fs = {0, x->key};
+    x->val = (struct zvalue)ZVINIT(ZF_NUM, zlist_append(&TT.file_slots, &fs), 0);
+  }
+  return (int)x->val.num;
 }
@@ -10,8 +10,9 @@
 #if !defined(__STDC_VERSION__) || __STDC_VERSION__ < 199901L
 #error Need C99 or greater
 #endif
-// Need _POSIX_C_SOURCE >=1 for fileno(); >=2 for popen()/pclose()
-#define _POSIX_C_SOURCE 2
+// Need _POSIX_C_SOURCE >=1 for fileno(); >=2 for popen()/pclose();
+// >=200112L for posix_madvise()
+#define _POSIX_C_SOURCE 200809L
 #ifndef __STDC_WANT_LIB_EXT2__
 #define __STDC_WANT_LIB_EXT2__ 1  // for getline()
 #endif
@@ -28,13 +29,39 @@
 #include <wctype.h>
 #include <errno.h>
 #include <assert.h>
+#include <limits.h>
 
 // for isatty():
 #include <unistd.h>
+// for fstat():
+#include <sys/stat.h>
+#include <signal.h>
+#ifdef _WIN32
+#define NO_MMAP   // no mmap() input for MinGW/msys build
+#define NO_FADVISE
+#define NO_MEMMEM
+#else
+// for mmap():
+#include <sys/mman.h>
+// for open(), posix_fadvise():
+#include <fcntl.h>
+#endif
+#ifdef __linux__
+// for --follow:
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+#ifdef __APPLE__
+#define NO_FADVISE  // macOS has no posix_fadvise()
+#endif
 // for getopt_long():
 #include <getopt.h>
 #include <regex.h>
 extern char **environ;    // needed outside toybox with gcc ?
+#ifndef NO_MEMMEM
+// Not declared under _POSIX_C_SOURCE by glibc
+void *memmem(const void *s, size_t n, const void *pat, size_t m);
+#endif
 
 // __USE_MINGW_ANSI_STDIO will have MinGW use its own printf format system?
 // Because "The vc6.0 msvcrt.dll that MinGW-w64 targets doesn't implement
@@ -49,6 +76,7 @@ ssize_t getline(char **lineptr, size_t *n, FILE *stream);
 
 #ifndef FOR_TOYBOX
 #define maxof(a,b) ((a)>(b)?(a):(b))
+#define minof(a,b) ((a)<(b)?(a):(b))
 
 #ifndef REG_STARTEND
 #define REG_STARTEND 0
@@ -112,6 +140,17 @@ struct compiler_globals {
   int rule_type;  // tkbegin, tkend, or 0
 };
 
+// A compiled regex, with text found in it by zregcomp() that decides many
+// matches without regexec(); see rx_quick()
+struct zregex {
+  regex_t rx;
+  char *lit;      // text every match contains, or null if none found
+  size_t litlen;
+  char plain;     // the regex is just lit (with ^ and $ as bol and eol)
+  char bol, eol;
+  struct dfa *dfa;  // for match/no match answers, or null; see dfa_match()
+};
+
 // zvalue: the main awk value type
 // Can be number or string or both, or else map (array) or regex
 struct zvalue {
@@ -120,10 +159,23 @@ struct zvalue {
   union {
     struct zstring *vst;
     struct zmap *map;
-    regex_t *rx;
+    struct zregex *rx;
   } u;
 };
 
+// Where splitting a string into fields stopped, so it can go on later
+struct split_state {
+  size_t offs;        // offset at which to resume
+  int nf;             // fields split so far
+  int eflag;          // REG_NOTBOL once past the start
+  int r;              // last rx_find_FS() result (nonzero: FS not found)
+  char nl_fs;         // newline also separates fields (RS == "")
+  char csv;           // split as CSV (--csv); see csv_split()
+  char fw;            // split by FIELDWIDTHS; see fw_split()
+  char ascii;         // FIELDWIDTHS: record is ASCII (or -b); cols == bytes
+  char pending;       // more fields remain to be split
+};
+
 struct runtime_globals {
   struct zvalue cur_arg;
   FILE *fp;           // current data file
@@ -131,7 +183,14 @@ struct runtime_globals {
   int nfiles;         // num of cmdline data file args processed
   int eof;            // all cmdline files (incl. stdin) read
   char *recptr;
+  char *rec0;         // $0 if still in input buffer; see own_field0()
+  size_t rec0len;
+  struct zfile *rec0_zfp;   // file whose buffer holds rec0
+  char field0_stale;        // a field or NF was set; $0 must be rebuilt
+  struct zstring *rebuild_ofs;  // OFS to rebuild $0 with
   struct zstring *zspr;      // Global to receive sprintf() string value
+  struct split_state split;  // fields of $0 are split on demand
+  struct zstring *split_fs;  // FS in effect when $0 was set
 };
 
 // zlist: expanding sequential list
@@ -148,8 +207,15 @@ struct zfile {
   char file_or_pipe;  // 1 if file, 0 if pipe
   char is_tty, is_std_file;
   char eof;
-  int ro, lim, buflen;
+  char is_mapped;   // buf is mmap()ed file, not malloc()ed
+  size_t ro, lim, buflen;
+  size_t ahead;     // mapped file read-ahead requested up to here
+  size_t partial;   // length of last record read if EOF ended it, not RS
   char *buf;
+  char *obuf;       // output buffer, OUTBUF_SIZE bytes
+  size_t olen;      // output bytes pending in obuf
+  int slot;         // index in TT.file_slots; see file_slot()
+  struct zfile *lru_prev, *lru_next;  // open output files; see park_file()
 };
 
 // Global data
@@ -175,19 +241,38 @@ struct global_data {
   struct runtime_globals rgl;
 
   char *pbuf;   // Used for number formatting in num_to_zstring()
-  regex_t rx_default, rx_last; // Default and last used FS regex
+  struct rx_cache *rx_cache;     // compiled dynamic regexes; rx_cached()
+  unsigned long rx_cache_tick;
 #define FS_MAX  64
   char fs_last[FS_MAX];
-  char one_char_fs[4];
+  int fs_mode;              // FS matcher type; see fs_prep()
+  char fs_run;              // FS_CLASS FS is [...]+
+  char fs_set[256];         // bytes in FS_CLASS FS
   int nf_internal;  // should match NF
+  int field_max;    // highest constant field number $n in the program
+  char field_dyn;   // program has $expr, not just constant field numbers
+  char nf_ref;      // program refers to NF, so every record is fully split
   char range_sw[64];   // FIXME TODO quick and dirty set of range switches
   int file_cnt, std_file_cnt;
   struct zfile *zfiles, *cfile, *zstdout;
+  struct zmap *file_map;    // i/o redirection name -> file table slot
+  struct zlist file_slots;  // name and open zfile (or null) per slot
+  int lru_cnt;              // output files open (not parked)
+  struct zmap *pfmt_map;    // printf format -> index in pfmts
+  struct zlist pfmts;       // compiled printf formats; see get_pfmt()
   regex_t rx_printf_fmt;
 
-#define RS_MAX  64
-  char rs_last[RS_MAX];
-  regex_t rx_rs_default, rx_rs_last;
+  char fw_mode;             // FIELDWIDTHS was assigned more recently than FS
+  struct zstring *fw_last;  // FIELDWIDTHS value fieldwidths was built for
+  struct zlist fieldwidths; // start column, width (int) per field; fw_prep()
+  struct zstring *rs_last;  // RS value the RS matcher was last built for
+  int rs_mode;              // RS matcher type; see rs_prep()
+  size_t reclen;            // record length if RECLEN > 0; see rs_prep()
+  regex_t rx_rs_last;
+
+  char *checkpoint_fn;      // --checkpoint state file (not in toybox)
+  struct zlist checkpoints; // input file positions; see load_checkpoints()
+  int max_files;            // --max-files limit on open output files
 };
 #endif  // FOR_TOYBOX
 enum toktypes {
@@ -242,7 +327,7 @@ enum opcodes {
 
 // Special variables (POSIX). Must align with char *spec_vars[]
 enum spec_var_names { ARGC=1, ARGV, CONVFMT, ENVIRON, FILENAME, FNR, FS, NF,
-    NR, OFMT, OFS, ORS, RLENGTH, RS, RSTART, SUBSEP };
+    NR, OFMT, OFS, ORS, RLENGTH, RS, RSTART, SUBSEP, FIELDWIDTHS, RECLEN };
 
 struct symtab_slot {    // global symbol table entry
   unsigned flags;
@@ -253,8 +338,8 @@ struct symtab_slot {    // global symbol table entry
 // Capacity must be > size because we insert a NUL byte.
 struct zstring {
   int refcnt;
-  unsigned size;
-  unsigned capacity;
+  size_t size;
+  size_t capacity;
   char str[];   // C99 flexible array member
 };
 
@@ -270,6 +355,7 @@ struct zstring {
 #define ZF_MAPREF   (1u << 10)  // for lvalues
 #define ZF_FIELDREF (1u << 11)  // for lvalues
 #define ZF_EMPTY_RX (1u << 12)
+#define ZF_NUMCHK   (1u << 13)  // string may be a numstr; see numstr_check()
 #define ZF_ANYMAP   (ZF_MAP | ZF_MAYBEMAP)
 
 // Macro to help facilitate possible future change in zvalue layout.
@@ -290,6 +376,7 @@ struct zstring {
 #define FIELD       ((struct zvalue *)TT.fields.base)
 
 #define ZCODE       ((int *)TT.zcode.base)
+#define FILESLOT    ((struct file_slot *)TT.file_slots.base)
 
 #define FUNC_DEFINED    (1u)
 #define FUNC_CALLED     (2u)
@@ -309,6 +396,12 @@ struct zmap_slot {
   struct zstring *key;
   struct zvalue val;
 };
+
+// File table slot; see file_slot()
+struct file_slot {
+  struct zfile *zfp;      // open (or parked) file, or null
+  struct zstring *name;   // file or command name; key in TT.file_map
+};
 #define ZMSLOTINIT(hash, key, val) {hash, key, val}
 
 // zmap: Mapping data type for arrays; a hash table. Values in hash are either
@@ -323,6 +416,7 @@ struct zmap {
   int limit;      // 80% of table size ((mask+1)*8/10)
   int count;      // number of occupied slots in hash
   int deleted;    // number of deleted slots
+  int split_cnt;  // slots are just the elements "1".."split_cnt" from split()
   struct zlist slot;     // expanding list of zmap_slot elements
 };
 
@@ -339,6 +433,8 @@ struct zmap {
 // Common (global) data
 struct optflags {
   char FLAG_b;
+  char FLAG_follow;
+  char FLAG_csv;
 };
 #define FLAG(x) (optflags.FLAG_##x)
 #ifndef MONOLITHIC
@@ -358,8 +454,6 @@ EXTERN char *ops, *keywords, *builtins;
 
 EXTERN struct compiler_globals cgl;
 
-EXTERN void zvalue_dup_zstring(struct zvalue *v);
-
 EXTERN void zzerr(char *format, ...);
 
 EXTERN void xregcomp(regex_t *preg, char *regex, int cflags);
@@ -368,8 +462,8 @@ EXTERN int regexec0(regex_t *preg, char *string, long len, int nmatch,
 EXTERN int wctoutf8(char *s, unsigned wc);
 EXTERN int utf8towc(unsigned *wc, char *str, unsigned len);
 
-EXTERN int bytesinutf8(char *str, size_t len, size_t cnt);
-EXTERN int utf8cnt(char *str, size_t len);
+EXTERN size_t bytesinutf8(char *str, size_t len, size_t cnt);
+EXTERN size_t utf8cnt(char *str, size_t len);
 
 EXTERN void awk_exit(int status);
 EXTERN void error_exit(char *format, ...);
@@ -379,6 +473,12 @@ EXTERN void *xrealloc(void *p, size_t size);
 EXTERN void *xzalloc(size_t size);
 EXTERN char *xstrdup(char *s);
 EXTERN int hexval(int c);
+EXTERN char *mem_find(char *s, size_t n, char *pat, size_t m);
+EXTERN struct dfa *dfa_compile(char *regex);
+EXTERN int dfa_match(struct dfa *d, char *s, size_t len, int eflags);
+EXTERN void dfa_free(struct dfa *d);
+EXTERN void zregcomp(struct zregex *zr, char *regex);
+EXTERN void zregfree(struct zregex *zr);
 EXTERN struct zlist *zlist_initx(struct zlist *p, size_t size, size_t count);
 EXTERN struct zlist *zlist_init(struct zlist *p, size_t size);
 EXTERN void zlist_expand(struct zlist *p);
@@ -388,7 +488,6 @@ EXTERN void get_token_text(char *op, int tk);
 EXTERN void zstring_release(struct zstring **s);
 EXTERN void zstring_incr_refcnt(struct zstring *s);
 EXTERN struct zstring *zstring_update(struct zstring *to, size_t at, char *s, size_t n);
-EXTERN struct zstring *zstring_copy(struct zstring *to, struct zstring *from);
 EXTERN struct zstring *zstring_extend(struct zstring *to, struct zstring *from);
 EXTERN struct zstring *new_zstring(char *s, size_t size);
 EXTERN struct zvalue new_str_val(char *s);
@@ -406,6 +505,8 @@ EXTERN void zmap_delete_map_incl_slotdata(struct zmap *m);
 EXTERN void zmap_delete_map(struct zmap *m);
 EXTERN struct zmap_slot *zmap_find_or_insert_key(struct zmap *m, struct zstring *key);
 EXTERN void zmap_delete(struct zmap *m, struct zstring *key);
+EXTERN void zmap_truncate(struct zmap *m, int n);
+EXTERN int file_slot(struct zstring *name);
 EXTERN void run(int optind, int argc, char **argv, char *sepstring,
     struct arg_list *assign_args);
 
@@ -53,9 +53,8 @@ static int make_literal_str_val(char *s)
 
 static int make_literal_regex_val(char *s)
 {
-  regex_t *rx;
-  rx = xmalloc(sizeof(*rx));
-  xregcomp(rx, s, REG_EXTENDED);
+  struct zregex *rx = xmalloc(sizeof(*rx));
+  zregcomp(rx, s);
   struct zvalue v = ZVINIT(ZF_RX, 0, 0);
   v.u.rx = rx;
   // Flag empty rx to make it easy to identify for split() special case
@@ -63,6 +62,20 @@ static int make_literal_regex_val(char *s)
   return zlist_append(&TT.literals, &v);
 }
 
+// If the code from zcode_start on is just a string constant, used as a
+// regex (by ~ !~ match() sub() gsub()), compile it now as a literal regex
+// instead of at each use. Not for split(), where a string that is a
+// single char or has no regex metachars is matched without a regex.
+static void promote_str_to_regex(int zcode_start)
+{
+  if (TT.zcode_last != zcode_start + 2 || ZCODE[zcode_start + 1] != tkstring)
+    return;
+  char *s = escape_str(xstrdup(LITERAL[ZCODE[TT.zcode_last]].u.vst->str), 1);
+  ZCODE[zcode_start + 1] = tkregex;
+  ZCODE[TT.zcode_last] = make_literal_regex_val(s);
+  xfree(s);
+}
+
 static int make_literal_num_val(double num)
 {
   struct zvalue v = ZVINIT(ZF_NUM, num, 0);
@@ -132,6 +145,7 @@ static int find_or_add_var_name(void)
     globals_ent = find_global(TT.tokstr);
     if (!globals_ent) globals_ent = add_global(TT.tokstr);
     slotnum = globals_ent;
+    if (slotnum == NF) TT.nf_ref = 1;   // records must be split in full
     if (find_func_def_entry(TT.tokstr))
       // POSIX: The same name shall not be used both as a variable name
       // with global scope and as the name of a function.
@@ -181,7 +195,7 @@ static void init_compiler(void)
   // Special variables (POSIX). Must align with enum spec_var_names
   static char *spec_vars[] = { "ARGC", "ARGV", "CONVFMT", "ENVIRON", "FILENAME",
       "FNR", "FS", "NF", "NR", "OFMT", "OFS", "ORS", "RLENGTH", "RS", "RSTART",
-      "SUBSEP", 0};
+      "SUBSEP", "FIELDWIDTHS", "RECLEN", 0};
 
   init_tables();
   for (int k = 0; spec_vars[k]; k++) {
@@ -368,7 +382,11 @@ static void builtin_call(int tk, char *builtin_name)
       if (ISTOK(tkregex)) {
         gen2cd(tkregex, make_literal_regex_val(TT.tokstr));
         scan();
-      } else expr(0);
+      } else {
+        int zcode_start = TT.zcode_last;
+        expr(0);
+        promote_str_to_regex(zcode_start);
+      }
       expect(tkcomma);
       optional_nl();
       expr(0);
@@ -388,7 +406,11 @@ static void builtin_call(int tk, char *builtin_name)
       if (ISTOK(tkregex)) {
         gen2cd(tkregex, make_literal_regex_val(TT.tokstr));
         scan();
-      } else expr(0);
+      } else {
+        int zcode_start = TT.zcode_last;
+        expr(0);
+        promote_str_to_regex(zcode_start);
+      }
       num_args = 2;
       break;
 
@@ -541,12 +563,18 @@ static void field_op(void)
 {
   // CURTOK() must be $ here.
   expect(tkfield);
+  int cdx = TT.zcode_last;
   // tkvar, tknumber, tkstring, tkregex, tkfunc, tkbuiltin, tkfield, tkminus,
   // tkplus, tknot, tkincr, tkdecr, tklparen, tkgetline, tkclose, tkindex,
   // tkmatch, tksplit, tksub, tkgsub, tksprintf, tksubstr
   if (ISTOK(tkfield)) field_op();
   else if (ISTOK(tkvar)) var();
   else primary();
+  // Note how far records need splitting for this; see split_fields()
+  if (TT.zcode_last == cdx + 2 && ZCODE[cdx + 1] == tknumber) {
+    double n = LITERAL[ZCODE[cdx + 2]].num;
+    if (n > TT.field_max) TT.field_max = n < INT_MAX ? n : INT_MAX;
+  } else TT.field_dyn = 1;
   // tkfield op has "dummy" 2nd word so that convert_push_to_reference(void)
   // can find either tkfield or tkvar at same place (ZCODE[TT.zcode_last-1]).
   gen2cd(tkfield, tkeof);
@@ -591,6 +619,20 @@ static void lvalue(void)
   }
 }
 
+// Compile the file name (or command) of an i/o redirection. If it is just a
+// string constant, it gets its file table slot now instead, so the run time
+// does not stack and look up the name every time. Returns the slot, or -1.
+static int redir_target(int rbp)
+{
+  int cdx = TT.zcode_last;
+  expr(rbp);
+  if (TT.zcode_last != cdx + 2 || ZCODE[cdx + 1] != tkstring) return -1;
+  int slot = file_slot(LITERAL[ZCODE[cdx + 2]].u.vst);
+  TT.zcode.avail -= 2 * TT.zcode.size;    // drop the tkstring instruction
+  TT.zcode_last = cdx;
+  return slot;
+}
+
 static int primary(void)
 {
   //  On entry: CURTOK() is first token of expression
@@ -618,7 +660,7 @@ static int primary(void)
   //      num, string, regex, var, var with subscripts, and function calls
 
   int num_exprs = 0;
-  int nargs, modifier;
+  int nargs, modifier, slot = -1;
   int tok = CURTOK();
   switch (tok) {
     case tkvar:
@@ -704,12 +746,12 @@ static int primary(void)
         nargs++;
       }
       if (havetok(tklt)) {
-        expr(getrbp(tkcat));   // bwk "historical practice" precedence
-        nargs++;
+        // bwk "historical practice" precedence
+        if ((slot = redir_target(getrbp(tkcat))) < 0) nargs++;
         modifier = tklt;
       }
       gen2cd(tkgetline, nargs);
-      gencd(modifier);
+      gen2cd(modifier, slot);
       break;
 
     default:
@@ -748,7 +790,7 @@ static void binary_op(int optor)  // Also for ternary ?: optor.
         nargs++;
       }
       gen2cd(tkgetline, nargs);
-      gencd(tkpipe);
+      gen2cd(tkpipe, -1);
       break;
 
   case tkand:
@@ -775,8 +817,10 @@ static void binary_op(int optor)  // Also for ternary ?: optor.
 
   case tkmatchop:
   case tknotmatch:
+      cdx = TT.zcode_last;
       expr(rbp);
       if (ZCODE[TT.zcode_last - 1] == opmatchrec) ZCODE[TT.zcode_last - 1] = tkregex;
+      promote_str_to_regex(cdx);
       gencd(optor);
       break;
 
@@ -856,7 +900,7 @@ static int expr(int rbp)
 static void print_stmt(int tk)
 {
   static char outmodes[] = {tkgt, tkappend, tkpipe, 0};
-  int num_exprs = 0, outmode;
+  int num_exprs = 0, outmode, slot = -1;
   TT.cgl.in_print_stmt = 1;
   expect(tk); // tkprint or tkprintf
   if ((tk == tkprintf) || !strchr(printexprendsy, CURTOK())) {
@@ -872,11 +916,11 @@ static void print_stmt(int tk)
   outmode = CURTOK();
   if (strchr(outmodes, outmode)) {
     scan();
-    expr(0); // FIXME s/b only bwk term? check POSIX
-    num_exprs++;
+    // FIXME s/b only bwk term? check POSIX
+    if ((slot = redir_target(0)) < 0) num_exprs++;
   } else outmode = 0;
   gen2cd(tk, num_exprs);
-  gencd(outmode);
+  gen2cd(outmode, slot);
   TT.cgl.in_print_stmt = 0;
 }
 
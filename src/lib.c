@@ -160,3 +160,559 @@ EXTERN int hexval(int c)
   // Assumes c is valid hex digit
   return isdigit(c) ? c - '0' : (c | 040) - 'a' + 10;
 }
+
+// Find pat (m bytes) in s (n bytes). memmem() (Two-Way in glibc and
+// musl) takes linear time; the fallback can take O(n * m).
+EXTERN char *mem_find(char *s, size_t n, char *pat, size_t m)
+{
+  if (!m) return s;
+  if (m > n) return 0;
+#if !defined(FOR_TOYBOX) && !defined(NO_MEMMEM)
+  return memmem(s, n, pat, m);
+#else
+  char *lim = s + n - m + 1, *p;
+  for (p = s; (p = memchr(p, *pat, lim - p)); p++)
+    if (!memcmp(p + 1, pat + 1, m - 1)) return p;
+  return 0;
+#endif
+}
+
+////////////////////
+//// DFA regex matcher
+////////////////////
+
+// A lazily built DFA that tells whether a regex matches anywhere in a
+// string, for when no match position is needed (see rx_quick() in run.c).
+// dfa_compile() parses the ERE into a tree and turns that into an NFA of
+// byte transitions; DFA states (sets of NFA nodes) and their transitions
+// are made as input needs them, and kept. Regexes with anything not
+// handled here (escapes other than of metachars, [:classes:] other than
+// digit and xdigit, non-ASCII in brackets, intervals over RE_DUP_MAX, etc.)
+// get no DFA. In a UTF-8 locale, . and [^...] match one UTF-8 char; a
+// subject that is not well-formed UTF-8 is left to regexec() if the
+// regex has those or non-ASCII chars.
+
+#define DFA_MAX_NFA 4000    // NFA nodes; a bigger regex gets no DFA
+#define DFA_MAX_STATES 512  // DFA states kept; all are dropped when full
+#define DFA_MAX_FLUSHES 8   // then the DFA is no faster; give it up
+
+enum dfa_tree_ops { DT_SET, DT_CAT, DT_ALT, DT_STAR, DT_PLUS, DT_QUEST,
+    DT_REP, DT_BOL, DT_EOL, DT_EMPTY };
+enum dfa_nfa_ops { DN_SET, DN_SPLIT, DN_BOL, DN_EOL, DN_MATCH };
+
+struct dfa_tree {
+  int op, a, b;   // a, b: operand trees; a: byte set for DT_SET
+  int min, max;   // DT_REP bounds; max < 0 for no upper bound
+};
+
+struct dfa_nfa {
+  int op, out, out1;  // out1: 2nd DN_SPLIT branch (or -1); set: DN_SET
+  int set;
+};
+
+struct dfa_state {
+  int next[256];    // state for each next byte, or -1 if not yet made
+  char match;       // has DN_MATCH: a match ends here
+  char eol_match;   // a match ends here if at end of string; -1 not known
+  char bol;         // made at start of string (^ matches)
+  unsigned hash;
+  int n;            // number of NFA nodes
+  int node[];       // NFA nodes (DN_SET, DN_EOL, DN_MATCH), sorted
+};
+
+struct dfa {
+  unsigned (*sets)[8];  // byte sets (bit maps) for DT_SET and DN_SET
+  int nsets;
+  struct dfa_tree *tree;
+  int ntree, tree_cap;
+  struct dfa_nfa *nfa;
+  int nnfa, nfa_cap, start;
+  char multibyte, check_utf8, bad;
+  char *p;              // parse position
+  struct dfa_state *states[DFA_MAX_STATES];
+  int nstates, start_state[2], flushes;
+  int hash[2 * DFA_MAX_STATES];   // state + 1, or 0 for empty
+  unsigned *mark, gen;  // NFA nodes already in the set being built
+  int *work, nwork;     // the set being built
+  char reached_match;
+};
+
+static void *dfa_grow(void *p, int n, int *cap, size_t size)
+{
+  if (n < *cap) return p;
+  *cap = *cap ? *cap * 2 : 64;
+  return xrealloc(p, *cap * size);
+}
+
+static int dfa_set(struct dfa *d, int lo, int hi)
+{
+  d->sets = xrealloc(d->sets, (d->nsets + 1) * sizeof(*d->sets));
+  memset(d->sets[d->nsets], 0, sizeof(*d->sets));
+  for (; lo <= hi; lo++) d->sets[d->nsets][lo / 32] |= 1u << lo % 32;
+  return d->nsets++;
+}
+
+static int dfa_tree(struct dfa *d, int op, int a, int b)
+{
+  d->tree = dfa_grow(d->tree, d->ntree, &d->tree_cap, sizeof(*d->tree));
+  d->tree[d->ntree] = (struct dfa_tree){op, a, b, 0, 0};
+  return d->ntree++;
+}
+
+// Tree for a regex dfa_compile() does not handle; sets d->bad
+static int dfa_bad(struct dfa *d)
+{
+  d->bad = 1;
+  return dfa_tree(d, DT_EMPTY, 0, 0);
+}
+
+// Tree for any multibyte UTF-8 char (subject is known well-formed)
+static int dfa_multibyte(struct dfa *d)
+{
+  static unsigned char lead[] = {0xc0, 0xdf, 0xe0, 0xef, 0xf0, 0xf7};
+  int t = -1;
+  for (int k = 1; k <= 3; k++) {
+    int seq = dfa_tree(d, DT_SET, dfa_set(d, lead[2 * k - 2], lead[2 * k - 1]), 0);
+    for (int j = 0; j < k; j++)
+      seq = dfa_tree(d, DT_CAT, seq, dfa_tree(d, DT_SET, dfa_set(d, 0x80, 0xbf), 0));
+    t = t < 0 ? seq : dfa_tree(d, DT_ALT, t, seq);
+  }
+  d->check_utf8 = 1;
+  return t;
+}
+
+// Tree for a bracket expression; d->p is just past the [
+static int dfa_bracket(struct dfa *d)
+{
+  unsigned char *p = (unsigned char *)d->p;
+  int neg = *p == '^', set = dfa_set(d, 0, -1), lo, hi;
+  p += neg;
+  for (int first = 1; first || *p != ']'; first = 0) {
+    if (!*p || (*p == '[' && (p[1] == '.' || p[1] == '='))) return dfa_bad(d);
+    if (*p == '[' && p[1] == ':') {
+      int isx = !strncmp((char *)p + 2, "xdigit:]", 8);
+      if (!isx && strncmp((char *)p + 2, "digit:]", 7)) return dfa_bad(d);
+      for (lo = 0; lo < 128; lo++)
+        if (isx ? isxdigit(lo) : isdigit(lo)) d->sets[set][lo / 32] |= 1u << lo % 32;
+      p += isx ? 10 : 9;
+      continue;
+    }
+    lo = hi = *p++;
+    if (*p == '-' && p[1] && p[1] != ']') {
+      hi = p[1];
+      if (hi == '[' || hi < lo) return dfa_bad(d);
+      p += 2;
+    }
+    if (hi > 127 && d->multibyte) return dfa_bad(d);
+    for (; lo <= hi; lo++) d->sets[set][lo / 32] |= 1u << lo % 32;
+  }
+  d->p = (char *)p + 1;
+  if (!neg) return dfa_tree(d, DT_SET, set, 0);
+  for (int k = 0; k < 8; k++)
+    d->sets[set][k] = ~d->sets[set][k] & (d->multibyte && k >= 4 ? 0 : ~0u);
+  set = dfa_tree(d, DT_SET, set, 0);
+  return d->multibyte ? dfa_tree(d, DT_ALT, set, dfa_multibyte(d)) : set;
+}
+
+static int dfa_alt(struct dfa *d);
+
+static int dfa_atom(struct dfa *d)
+{
+  unsigned char c = *d->p++;
+  int t;
+  switch (c) {
+    case '(':
+      t = *d->p == ')' ? dfa_tree(d, DT_EMPTY, 0, 0) : dfa_alt(d);
+      if (*d->p++ != ')') d->bad = 1;
+      return t;
+    case '[': return dfa_bracket(d);
+    case '^': return dfa_tree(d, DT_BOL, 0, 0);
+    case '$': return dfa_tree(d, DT_EOL, 0, 0);
+    case '.':   // As in glibc, . does not match a nul byte
+      if (!d->multibyte) return dfa_tree(d, DT_SET, dfa_set(d, 1, 255), 0);
+      return dfa_tree(d, DT_ALT, dfa_tree(d, DT_SET, dfa_set(d, 1, 127), 0),
+          dfa_multibyte(d));
+    case '\\':
+      c = *d->p++;
+      if (!c || !strchr("\\^$.[]|()*+?{}", c)) return dfa_bad(d);
+      break;
+    case ')': case '*': case '+': case '?': case '{':
+      return dfa_bad(d);
+  }
+  t = dfa_tree(d, DT_SET, dfa_set(d, c, c), 0);
+  if (c < 0x80 || !d->multibyte) return t;
+  // A multibyte char is one atom, for quantifiers
+  d->check_utf8 = 1;
+  for (int k = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1; k--; ) {
+    if ((*d->p & 0xc0) != 0x80) return dfa_bad(d);
+    c = *d->p++;
+    t = dfa_tree(d, DT_CAT, t, dfa_tree(d, DT_SET, dfa_set(d, c, c), 0));
+  }
+  return t;
+}
+
+// Return nonzero if tree t has ^ or $
+static int dfa_anchored(struct dfa *d, int t)
+{
+  struct dfa_tree *tr = d->tree + t;
+  switch (tr->op) {
+    case DT_BOL: case DT_EOL: return 1;
+    case DT_CAT: case DT_ALT:
+      return dfa_anchored(d, tr->a) || dfa_anchored(d, tr->b);
+    case DT_STAR: case DT_PLUS: case DT_QUEST: case DT_REP:
+      return dfa_anchored(d, tr->a);
+  }
+  return 0;
+}
+
+static int dfa_piece(struct dfa *d)
+{
+  int t = dfa_atom(d);
+  for (char *q; !d->bad && *d->p && strchr("*+?{", *d->p); ) {
+    // glibc mishandles e.g. (^a|b){2}, so leave repeated anchors to it
+    if (dfa_anchored(d, t)) return dfa_bad(d);
+    char c = *d->p++;
+    if (c != '{') {
+      t = dfa_tree(d, c == '*' ? DT_STAR : c == '+' ? DT_PLUS : DT_QUEST, t, 0);
+      continue;
+    }
+    if (!isdigit(*d->p)) return dfa_bad(d);
+    long min = strtol(d->p, &q, 10), max = min;
+    if (*q == ',') max = isdigit(*++q) ? strtol(q, &q, 10) : -1;
+    if (*q != '}' || min > RE_DUP_MAX || max > RE_DUP_MAX
+        || (max >= 0 && max < min)) return dfa_bad(d);
+    d->p = q + 1;
+    t = dfa_tree(d, DT_REP, t, 0);
+    d->tree[t].min = min;
+    d->tree[t].max = max;
+  }
+  return t;
+}
+
+static int dfa_alt(struct dfa *d)
+{
+  int t = -1;
+  for (;;) {
+    int branch = -1;
+    while (!d->bad && *d->p && *d->p != '|' && *d->p != ')') {
+      int piece = dfa_piece(d);
+      branch = branch < 0 ? piece : dfa_tree(d, DT_CAT, branch, piece);
+    }
+    if (branch < 0) return dfa_bad(d);    // empty branch
+    t = t < 0 ? branch : dfa_tree(d, DT_ALT, t, branch);
+    if (d->bad || *d->p != '|') return t;
+    d->p++;
+  }
+}
+
+static int dfa_node(struct dfa *d, int op, int out, int out1, int set)
+{
+  if (d->nnfa == DFA_MAX_NFA) {
+    d->bad = 1;
+    return 0;
+  }
+  d->nfa = dfa_grow(d->nfa, d->nnfa, &d->nfa_cap, sizeof(*d->nfa));
+  d->nfa[d->nnfa] = (struct dfa_nfa){op, out, out1, set};
+  return d->nnfa++;
+}
+
+// Make NFA nodes for tree t, going on to node next; return first node
+static int dfa_emit(struct dfa *d, int t, int next)
+{
+  struct dfa_tree tr = d->tree[t];
+  int s, k;
+  if (d->bad) return 0;
+  switch (tr.op) {
+    case DT_SET: return dfa_node(d, DN_SET, next, -1, tr.a);
+    case DT_CAT: return dfa_emit(d, tr.a, dfa_emit(d, tr.b, next));
+    case DT_ALT:
+      return dfa_node(d, DN_SPLIT, dfa_emit(d, tr.a, next),
+          dfa_emit(d, tr.b, next), 0);
+    case DT_QUEST: return dfa_node(d, DN_SPLIT, dfa_emit(d, tr.a, next), next, 0);
+    case DT_STAR:
+    case DT_PLUS:
+      s = dfa_node(d, DN_SPLIT, -1, next, 0);
+      k = dfa_emit(d, tr.a, s);
+      if (!d->bad) d->nfa[s].out = k;
+      return tr.op == DT_STAR ? s : k;
+    case DT_REP:
+      if (tr.max < 0) {
+        s = dfa_node(d, DN_SPLIT, -1, next, 0);
+        k = dfa_emit(d, tr.a, s);
+        if (!d->bad) d->nfa[s].out = k;
+        next = s;
+      } else for (k = tr.min; k < tr.max; k++)
+        next = dfa_node(d, DN_SPLIT, dfa_emit(d, tr.a, next), next, 0);
+      for (k = 0; k < tr.min; k++) next = dfa_emit(d, tr.a, next);
+      return next;
+    case DT_BOL: return dfa_node(d, DN_BOL, next, -1, 0);
+    case DT_EOL: return dfa_node(d, DN_EOL, next, -1, 0);
+  }
+  return next;    // DT_EMPTY
+}
+
+EXTERN void dfa_free(struct dfa *d)
+{
+  if (!d) return;
+  for (int k = 0; k < d->nstates; k++) xfree(d->states[k]);
+  xfree(d->sets);
+  xfree(d->tree);
+  xfree(d->nfa);
+  xfree(d->mark);
+  xfree(d->work);
+  xfree(d);
+}
+
+// Return a DFA for ERE regex, or null if it has anything not handled
+EXTERN struct dfa *dfa_compile(char *regex)
+{
+  struct dfa *d = xzalloc(sizeof(*d));
+  d->multibyte = MB_CUR_MAX > 1;
+  d->p = regex;
+  int t = *regex ? dfa_alt(d) : dfa_tree(d, DT_EMPTY, 0, 0);
+  if (!d->bad && *d->p) d->bad = 1;   // unmatched )
+  if (!d->bad) d->start = dfa_emit(d, t, dfa_node(d, DN_MATCH, -1, -1, 0));
+  xfree(d->tree);
+  d->tree = 0;
+  if (d->bad) {
+    dfa_free(d);
+    return 0;
+  }
+  d->mark = xzalloc(d->nnfa * sizeof(*d->mark));
+  d->work = xmalloc(d->nnfa * sizeof(*d->work));
+  d->start_state[0] = d->start_state[1] = -1;
+  return d;
+}
+
+// Add NFA node n, and those reached from it without reading a byte, to
+// the set being built
+static void dfa_add(struct dfa *d, int n, int bol, int eol)
+{
+  if (d->mark[n] == d->gen) return;
+  d->mark[n] = d->gen;
+  struct dfa_nfa *x = d->nfa + n;
+  switch (x->op) {
+    case DN_SPLIT:
+      dfa_add(d, x->out, bol, eol);
+      if (x->out1 >= 0) dfa_add(d, x->out1, bol, eol);
+      return;
+    case DN_BOL:
+      if (bol) dfa_add(d, x->out, bol, eol);
+      return;
+    case DN_EOL:
+      if (eol) {
+        dfa_add(d, x->out, bol, eol);
+        return;
+      }
+      break;
+    case DN_MATCH:
+      d->reached_match = 1;
+  }
+  d->work[d->nwork++] = n;
+}
+
+static int dfa_cmp(const void *a, const void *b)
+{
+  return *(int *)a - *(int *)b;
+}
+
+// Find or make the state for the set built in d->work
+static int dfa_state(struct dfa *d, int bol)
+{
+  qsort(d->work, d->nwork, sizeof(int), dfa_cmp);
+  unsigned h = bol;
+  for (int k = 0; k < d->nwork; k++) h = h * 31 + d->work[k];
+  int slot = h & (2 * DFA_MAX_STATES - 1);
+  for (int i; (i = d->hash[slot]); slot = (slot + 1) & (2 * DFA_MAX_STATES - 1)) {
+    struct dfa_state *st = d->states[i - 1];
+    if (st->hash == h && st->bol == bol && st->n == d->nwork
+        && !memcmp(st->node, d->work, d->nwork * sizeof(int))) return i - 1;
+  }
+  struct dfa_state *st = xmalloc(sizeof(*st) + d->nwork * sizeof(int));
+  memset(st->next, -1, sizeof(st->next));
+  st->match = d->reached_match;
+  st->eol_match = -1;
+  st->bol = bol;
+  st->hash = h;
+  st->n = d->nwork;
+  memcpy(st->node, d->work, d->nwork * sizeof(int));
+  d->hash[slot] = d->nstates + 1;
+  d->states[d->nstates] = st;
+  return d->nstates++;
+}
+
+static void dfa_flush(struct dfa *d)
+{
+  for (int k = 0; k < d->nstates; k++) xfree(d->states[k]);
+  d->nstates = 0;
+  d->flushes++;
+  memset(d->hash, 0, sizeof(d->hash));
+  d->start_state[0] = d->start_state[1] = -1;
+}
+
+static void dfa_begin_set(struct dfa *d)
+{
+  if (!++d->gen) {
+    memset(d->mark, 0, d->nnfa * sizeof(*d->mark));
+    d->gen = 1;
+  }
+  d->nwork = 0;
+  d->reached_match = 0;
+}
+
+// Return the state after state si reads byte c
+static int dfa_step(struct dfa *d, int si, int c)
+{
+  struct dfa_state *st = d->states[si];
+  dfa_begin_set(d);
+  for (int k = 0; k < st->n; k++) {
+    struct dfa_nfa *x = d->nfa + st->node[k];
+    if (x->op == DN_SET && d->sets[x->set][c / 32] & 1u << c % 32)
+      dfa_add(d, x->out, 0, 0);
+  }
+  dfa_add(d, d->start, 0, 0);   // a match may also start after c
+  if (d->nstates == DFA_MAX_STATES) {
+    dfa_flush(d);
+    return dfa_state(d, 0);
+  }
+  return st->next[c] = dfa_state(d, 0);
+}
+
+// Return nonzero if s is well-formed UTF-8
+static int utf8_wellformed(unsigned char *s, unsigned char *lim)
+{
+  while (s < lim) {
+    unsigned c = *s++, n = c < 0x80 ? 0 : c < 0xc2 ? 9 : c < 0xe0 ? 1
+        : c < 0xf0 ? 2 : c < 0xf5 ? 3 : 9;
+    if (n == 9 || (size_t)(lim - s) < n) return 0;
+    // 2nd byte limits for E0, ED, F0, F4 exclude overlong forms,
+    // surrogates and code points past U+10FFFF
+    unsigned lo = c == 0xe0 ? 0xa0 : c == 0xf0 ? 0x90 : 0x80,
+             hi = c == 0xed ? 0x9f : c == 0xf4 ? 0x8f : 0xbf;
+    for (unsigned k = 0; k < n; k++, lo = 0x80, hi = 0xbf)
+      if (s[k] < lo || s[k] > hi) return 0;
+    s += n;
+  }
+  return 1;
+}
+
+// Return 0 if d matches somewhere in s (len bytes), REG_NOMATCH if not,
+// or -1 if regexec() must decide (s is not well-formed UTF-8). Return -2
+// if d has had to drop its states too often; regexec() should be used
+// from then on, and d freed.
+// eflags may have REG_NOTBOL and REG_NOTEOL.
+EXTERN int dfa_match(struct dfa *d, char *s, size_t len, int eflags)
+{
+  unsigned char *p = (unsigned char *)s, *lim = p + len;
+  int bol = !(eflags & REG_NOTBOL), si = d->start_state[bol], checked = 0;
+  if (si < 0) {
+    dfa_begin_set(d);
+    dfa_add(d, d->start, bol, 0);
+    if (d->nstates == DFA_MAX_STATES) dfa_flush(d);
+    si = d->start_state[bol] = dfa_state(d, bol);
+  }
+  struct dfa_state *st = d->states[si];
+  for (; !st->match && p < lim; p++) {
+    if (*p >= 0x80 && d->check_utf8 && !checked++
+        && !utf8_wellformed(p, lim)) return -1;
+    int ni = st->next[*p];
+    if (ni < 0) {
+      ni = dfa_step(d, si, *p);
+      if (d->flushes > DFA_MAX_FLUSHES) return -2;
+    }
+    st = d->states[si = ni];
+  }
+  if (st->match) return 0;
+  if (eflags & REG_NOTEOL) return REG_NOMATCH;
+  if (st->eol_match < 0) {
+    dfa_begin_set(d);
+    for (int k = 0; k < st->n; k++) dfa_add(d, st->node[k], st->bol, 1);
+    st->eol_match = d->reached_match;
+  }
+  return st->eol_match ? 0 : REG_NOMATCH;
+}
+
+// Return p past the bracket expression that starts just before p
+static char *skip_bracket(char *p)
+{
+  if (*p == '^') p++;
+  if (*p == ']') p++;
+  for (; *p && *p != ']'; p++)
+    if (*p == '[' && p[1] && strchr(":.=", p[1])) {
+      char *e = strchr(p + 2, p[1]);
+      while (e && e[1] != ']') e = strchr(e + 1, p[1]);
+      if (e) p = e + 1;
+    }
+  return *p ? p + 1 : p;
+}
+
+// Compile ERE regex into zr, and find in it the longest run of plain chars
+// that every match must contain (none if there is a | outside parens). If
+// the regex is nothing but that run, maybe with ^ before or $ after, it is
+// plain text. This reads regex only as far as needed for that: anything
+// not known to be plain (brackets, groups, . and \ escapes other than of
+// metachars) just ends a run, and a char made optional by * ? or {} is
+// dropped from it.
+EXTERN void zregcomp(struct zregex *zr, char *regex)
+{
+  xregcomp(&zr->rx, regex, REG_EXTENDED);
+  zr->dfa = 0;
+  size_t n = 0, best = 0;
+  char *run = xmalloc(strlen(regex) + 1), *lit = xmalloc(strlen(regex) + 1);
+  char *p = regex;
+  int plain = 1;
+  zr->bol = *p == '^';
+  zr->eol = 0;
+  p += zr->bol;
+  while (*p) {
+    int c = *p++;
+    if (c == '\\' && *p && strchr("\\^$.[]|()*+?{}", *p)) c = *p++;
+    else if (c == '|') {
+      plain = n = best = 0;
+      break;
+    } else if (c == '$' && !*p) {
+      zr->eol = 1;
+      break;
+    } else if (strchr("\\^$.[(){*?+", c)) {
+      plain = 0;
+      if (c == '\\' && *p) p++;
+      else if (c == '[') p = skip_bracket(p);
+      else if (c == '(') {
+        for (int depth = 1; *p && depth; p++) {
+          if (*p == '\\' && p[1]) p++;
+          else if (*p == '[') p = skip_bracket(p + 1) - 1;
+          else depth += (*p == '(') - (*p == ')');
+        }
+      } else if (c == '{' || c == '*' || c == '?') {
+        // Drop the char (maybe multibyte) the quantifier applies to
+        while (n && (run[n - 1] & 0xc0) == 0x80) n--;
+        if (n) n--;
+        if (c == '{') {
+          p += strcspn(p, "}");
+          if (*p) p++;
+        }
+      }
+      if (n > best) memcpy(lit, run, best = n);
+      n = 0;
+      continue;
+    }
+    run[n++] = c;
+  }
+  if (n > best) memcpy(lit, run, best = n);
+  xfree(run);
+  zr->plain = plain;
+  zr->litlen = best;
+  if (!best && !plain) {
+    xfree(lit);
+    lit = 0;
+  } else lit[best] = 0;
+  zr->lit = lit;
+  if (!plain) zr->dfa = dfa_compile(regex);
+}
+
+EXTERN void zregfree(struct zregex *zr)
+{
+  regfree(&zr->rx);
+  xfree(zr->lit);
+  dfa_free(zr->dfa);
+}
@@ -72,6 +72,10 @@ int main(int argc, char **argv)
       "also:\n"
       "-V or --version  show version\n"
       "-h or --help     show this usage screen\n"
+      "--follow         at end of last input file, wait for more (as tail -F)\n"
+      "--checkpoint file  resume input files where the last run with file left off\n"
+      "--max-files n    keep at most n output files open; reopen others as needed\n"
+      "--csv            input is CSV: quoted fields may hold commas and newlines\n"
 
       "-b use bytes, not characters\n"
       "-c compile only, do not run\n"
@@ -89,7 +93,10 @@ int main(int argc, char **argv)
   struct arg_list *prog_args = 0, **tail_prog_args = &prog_args;
   struct arg_list *assign_args = 0, **tail_assign_args = &assign_args;
 
-  struct option longopts[] = {{"version", 0, 0, 'V'}, {"help", 0, 0, 'h'}, {0}};
+  enum { OPT_FOLLOW = 256, OPT_CHECKPOINT, OPT_MAX_FILES, OPT_CSV };
+  struct option longopts[] = {{"version", 0, 0, 'V'}, {"help", 0, 0, 'h'},
+    {"follow", 0, 0, OPT_FOLLOW}, {"checkpoint", 1, 0, OPT_CHECKPOINT},
+    {"max-files", 1, 0, OPT_MAX_FILES}, {"csv", 0, 0, OPT_CSV}, {0}};
   
   char *p = setlocale(LC_CTYPE, "");
   if (!p || !strstr(p, "UTF-8")) p = setlocale(LC_CTYPE, "C.UTF-8");
@@ -115,6 +122,19 @@ int main(int argc, char **argv)
       case 'c':
         opt_run_prog = 0;
         break;
+      case OPT_FOLLOW:
+        optflags.FLAG_follow = 1;
+        break;
+      case OPT_CHECKPOINT:
+        TT.checkpoint_fn = optarg;
+        break;
+      case OPT_MAX_FILES:
+        if ((TT.max_files = atoi(optarg)) < 1)
+          error_exit("bad --max-files value '%s'", optarg);
+        break;
+      case OPT_CSV:
+        optflags.FLAG_csv = 1;
+        break;
       case 'h':
         printf("%s", usage);
         exit(0);
@@ -12,7 +12,7 @@
  *
  * TODO: Lazy field splitting; improve performance; more testing/debugging
 
-USE_AWK(NEWTOY(awk, "F:v*f*bc", TOYFLAG_USR|TOYFLAG_BIN|TOYFLAG_LINEBUF))
+USE_AWK(NEWTOY(awk, "(csv)F:v*f*bc", TOYFLAG_USR|TOYFLAG_BIN|TOYFLAG_LINEBUF))
 
 config AWK
   bool "awk"
@@ -25,6 +25,7 @@ config AWK
       also:
       -b : count bytes, not characters (experimental)
       -c : compile only, do not run
+      --csv : input is CSV (quoted fields; FS and RS ignored)
 */
 
 #define FOR_awk
@@ -87,7 +88,14 @@ GLOBALS(
     union { // anonymous union not in C99; not going to fix it now.
       struct zstring *vst;
       struct zmap *map;
-      regex_t *rx;
+      struct zregex {
+        regex_t rx;
+        char *lit;      // text every match contains, or null if none found
+        size_t litlen;
+        char plain;     // the regex is just lit (with ^ and $ as bol and eol)
+        char bol, eol;
+        struct dfa *dfa;  // for match/no match answers, or null; see dfa_match()
+      } *rx;
     };
   } nozvalue;   // to shut up compiler warning TODO FIXME
 
@@ -98,7 +106,25 @@ GLOBALS(
     int nfiles;         // num of cmdline data file args processed
     int eof;            // all cmdline files (incl. stdin) read
     char *recptr;
+    char *rec0;         // $0 if still in input buffer; see own_field0()
+    size_t rec0len;
+    struct zfile *rec0_zfp;   // file whose buffer holds rec0
+    char field0_stale;        // a field or NF was set; $0 must be rebuilt
+    struct zstring *rebuild_ofs;  // OFS to rebuild $0 with
     struct zstring *zspr;      // Global to receive sprintf() string value
+    // Where splitting a string into fields stopped, so it can go on later
+    struct split_state {
+      size_t offs;        // offset at which to resume
+      int nf;             // fields split so far
+      int eflag;          // REG_NOTBOL once past the start
+      int r;              // last rx_find_FS() result (nonzero: FS not found)
+      char nl_fs;         // newline also separates fields (RS == "")
+      char csv;           // split as CSV (--csv); see csv_split()
+      char fw;            // split by FIELDWIDTHS; see fw_split()
+      char ascii;         // FIELDWIDTHS: record is ASCII (or -b); cols == bytes
+      char pending;       // more fields remain to be split
+    } split;              // fields of $0 are split on demand
+    struct zstring *split_fs;  // FS in effect when $0 was set
   } rgl;
 
   // Expanding sequential list
@@ -118,14 +144,25 @@ GLOBALS(
   struct zvalue *stackp;  // top of stack ptr
 
   char *pbuf;   // Used for number formatting in num_to_zstring()
-#define RS_MAX  64
-  char rs_last[RS_MAX];
-  regex_t rx_rs_default, rx_rs_last;
-  regex_t rx_default, rx_last, rx_printf_fmt;
+  char fw_mode;             // FIELDWIDTHS was assigned more recently than FS
+  struct zstring *fw_last;  // FIELDWIDTHS value fieldwidths was built for
+  struct zlist fieldwidths; // start column, width (int) per field; fw_prep()
+  struct zstring *rs_last;  // RS value the RS matcher was last built for
+  int rs_mode;              // RS matcher type; see rs_prep()
+  size_t reclen;            // record length if RECLEN > 0; see rs_prep()
+  regex_t rx_rs_last;
+  regex_t rx_printf_fmt;
+  struct rx_cache *rx_cache;     // compiled dynamic regexes; rx_cached()
+  unsigned long rx_cache_tick;
 #define FS_MAX  64
   char fs_last[FS_MAX];
-  char one_char_fs[4];
+  int fs_mode;              // FS matcher type; see fs_prep()
+  char fs_run;              // FS_CLASS FS is [...]+
+  char fs_set[256];         // bytes in FS_CLASS FS
   int nf_internal;  // should match NF
+  int field_max;    // highest constant field number $n in the program
+  char field_dyn;   // program has $expr, not just constant field numbers
+  char nf_ref;      // program refers to NF, so every record is fully split
   char range_sw[64];   // FIXME TODO quick and dirty set of range switches
   int file_cnt, std_file_cnt;
 
@@ -137,9 +174,21 @@ GLOBALS(
     char file_or_pipe;  // 1 if file, 0 if pipe
     char is_tty, is_std_file;
     char eof;
-    int ro, lim, buflen;
+    char is_mapped;   // buf is mmap()ed file, not malloc()ed
+    size_t ro, lim, buflen;
+    size_t ahead;     // mapped file read-ahead requested up to here
+    size_t partial;   // length of last record read if EOF ended it, not RS
     char *buf;
+    char *obuf;       // output buffer, OUTBUF_SIZE bytes
+    size_t olen;      // output bytes pending in obuf
+    int slot;         // index in TT.file_slots; see file_slot()
+    struct zfile *lru_prev, *lru_next;  // open output files; see park_file()
   } *zfiles, *cfile, *zstdout;
+  struct zmap *file_map;    // i/o redirection name -> file table slot
+  struct zlist file_slots;  // name and open zfile (or null) per slot
+  int lru_cnt;              // output files open (not parked)
+  struct zmap *pfmt_map;    // printf format -> index in pfmts
+  struct zlist pfmts;       // compiled printf formats; see get_pfmt()
 )
 
 static void awk_exit(int status)
@@ -206,7 +255,7 @@ enum opcodes {
 
 // Special variables (POSIX). Must align with char *spec_vars[]
 enum spec_var_names { ARGC=1, ARGV, CONVFMT, ENVIRON, FILENAME, FNR, FS, NF,
-    NR, OFMT, OFS, ORS, RLENGTH, RS, RSTART, SUBSEP };
+    NR, OFMT, OFS, ORS, RLENGTH, RS, RSTART, SUBSEP, FIELDWIDTHS, RECLEN };
 
 struct symtab_slot {    // global symbol table entry
   unsigned flags;
@@ -217,8 +266,8 @@ struct symtab_slot {    // global symbol table entry
 // Capacity must be > size because we insert a NUL byte.
 struct zstring {
   int refcnt;
-  unsigned size;
-  unsigned capacity;
+  size_t size;
+  size_t capacity;
   char str[];   // C99 flexible array member
 };
 
@@ -234,6 +283,7 @@ struct zstring {
 #define ZF_MAPREF   (1u << 10)  // for lvalues
 #define ZF_FIELDREF (1u << 11)  // for lvalues
 #define ZF_EMPTY_RX (1u << 12)
+#define ZF_NUMCHK   (1u << 13)  // string may be a numstr; see numstr_check()
 #define ZF_ANYMAP   (ZF_MAP | ZF_MAYBEMAP)
 
 // Macro to help facilitate possible future change in zvalue layout.
@@ -254,6 +304,7 @@ struct zstring {
 #define FIELD       ((struct zvalue *)TT.fields.base)
 
 #define ZCODE       ((int *)TT.zcode.base)
+#define FILESLOT    ((struct file_slot *)TT.file_slots.base)
 
 #define FUNC_DEFINED    (1u)
 #define FUNC_CALLED     (2u)
@@ -273,6 +324,12 @@ struct zmap_slot {
   struct zstring *key;
   struct zvalue val;
 };
+
+// File table slot; see file_slot()
+struct file_slot {
+  struct zfile *zfp;      // open (or parked) file, or null
+  struct zstring *name;   // file or command name; key in TT.file_map
+};
 #define ZMSLOTINIT(hash, key, val) {hash, key, val}
 
 // zmap: Mapping data type for arrays; a hash table. Values in hash are either
@@ -287,6 +344,7 @@ struct zmap {
   int limit;      // 80% of table size ((mask+1)*8/10)
   int count;      // number of occupied slots in hash
   int deleted;    // number of deleted slots
+  int split_cnt;  // slots are just the elements "1".."split_cnt" from split()
   struct zlist slot;     // expanding list of zmap_slot elements
 };
 
@@ -314,6 +372,562 @@ static int hexval(int c)
   return isdigit(c) ? c - '0' : (c | 040) - 'a' + 10;
 }
 
+// Find pat (m bytes) in s (n bytes). memmem() (Two-Way in glibc and
+// musl) takes linear time; the fallback can take O(n * m).
+static char *mem_find(char *s, size_t n, char *pat, size_t m)
+{
+  if (!m) return s;
+  if (m > n) return 0;
+#if !defined(FOR_TOYBOX) && !defined(NO_MEMMEM)
+  return memmem(s, n, pat, m);
+#else
+  char *lim = s + n - m + 1, *p;
+  for (p = s; (p = memchr(p, *pat, lim - p)); p++)
+    if (!memcmp(p + 1, pat + 1, m - 1)) return p;
+  return 0;
+#endif
+}
+
+////////////////////
+//// DFA regex matcher
+////////////////////
+
+// A lazily built DFA that tells whether a regex matches anywhere in a
+// string, for when no match position is needed (see rx_quick() in run.c).
+// dfa_compile() parses the ERE into a tree and turns that into an NFA of
+// byte transitions; DFA states (sets of NFA nodes) and their transitions
+// are made as input needs them, and kept. Regexes with anything not
+// handled here (escapes other than of metachars, [:classes:] other than
+// digit and xdigit, non-ASCII in brackets, intervals over RE_DUP_MAX, etc.)
+// get no DFA. In a UTF-8 locale, . and [^...] match one UTF-8 char; a
+// subject that is not well-formed UTF-8 is left to regexec() if the
+// regex has those or non-ASCII chars.
+
+#define DFA_MAX_NFA 4000    // NFA nodes; a bigger regex gets no DFA
+#define DFA_MAX_STATES 512  // DFA states kept; all are dropped when full
+#define DFA_MAX_FLUSHES 8   // then the DFA is no faster; give it up
+
+enum dfa_tree_ops { DT_SET, DT_CAT, DT_ALT, DT_STAR, DT_PLUS, DT_QUEST,
+    DT_REP, DT_BOL, DT_EOL, DT_EMPTY };
+enum dfa_nfa_ops { DN_SET, DN_SPLIT, DN_BOL, DN_EOL, DN_MATCH };
+
+struct dfa_tree {
+  int op, a, b;   // a, b: operand trees; a: byte set for DT_SET
+  int min, max;   // DT_REP bounds; max < 0 for no upper bound
+};
+
+struct dfa_nfa {
+  int op, out, out1;  // out1: 2nd DN_SPLIT branch (or -1); set: DN_SET
+  int set;
+};
+
+struct dfa_state {
+  int next[256];    // state for each next byte, or -1 if not yet made
+  char match;       // has DN_MATCH: a match ends here
+  char eol_match;   // a match ends here if at end of string; -1 not known
+  char bol;         // made at start of string (^ matches)
+  unsigned hash;
+  int n;            // number of NFA nodes
+  int node[];       // NFA nodes (DN_SET, DN_EOL, DN_MATCH), sorted
+};
+
+struct dfa {
+  unsigned (*sets)[8];  // byte sets (bit maps) for DT_SET and DN_SET
+  int nsets;
+  struct dfa_tree *tree;
+  int ntree, tree_cap;
+  struct dfa_nfa *nfa;
+  int nnfa, nfa_cap, start;
+  char multibyte, check_utf8, bad;
+  char *p;              // parse position
+  struct dfa_state *states[DFA_MAX_STATES];
+  int nstates, start_state[2], flushes;
+  int hash[2 * DFA_MAX_STATES];   // state + 1, or 0 for empty
+  unsigned *mark, gen;  // NFA nodes already in the set being built
+  int *work, nwork;     // the set being built
+  char reached_match;
+};
+
+static void *dfa_grow(void *p, int n, int *cap, size_t size)
+{
+  if (n < *cap) return p;
+  *cap = *cap ? *cap * 2 : 64;
+  return xrealloc(p, *cap * size);
+}
+
+static int dfa_set(struct dfa *d, int lo, int hi)
+{
+  d->sets = xrealloc(d->sets, (d->nsets + 1) * sizeof(*d->sets));
+  memset(d->sets[d->nsets], 0, sizeof(*d->sets));
+  for (; lo <= hi; lo++) d->sets[d->nsets][lo / 32] |= 1u << lo % 32;
+  return d->nsets++;
+}
+
+static int dfa_tree(struct dfa *d, int op, int a, int b)
+{
+  d->tree = dfa_grow(d->tree, d->ntree, &d->tree_cap, sizeof(*d->tree));
+  d->tree[d->ntree] = (struct dfa_tree){op, a, b, 0, 0};
+  return d->ntree++;
+}
+
+// Tree for a regex dfa_compile() does not handle; sets d->bad
+static int dfa_bad(struct dfa *d)
+{
+  d->bad = 1;
+  return dfa_tree(d, DT_EMPTY, 0, 0);
+}
+
+// Tree for any multibyte UTF-8 char (subject is known well-formed)
+static int dfa_multibyte(struct dfa *d)
+{
+  static unsigned char lead[] = {0xc0, 0xdf, 0xe0, 0xef, 0xf0, 0xf7};
+  int t = -1;
+  for (int k = 1; k <= 3; k++) {
+    int seq = dfa_tree(d, DT_SET, dfa_set(d, lead[2 * k - 2], lead[2 * k - 1]), 0);
+    for (int j = 0; j < k; j++)
+      seq = dfa_tree(d, DT_CAT, seq, dfa_tree(d, DT_SET, dfa_set(d, 0x80, 0xbf), 0));
+    t = t < 0 ? seq : dfa_tree(d, DT_ALT, t, seq);
+  }
+  d->check_utf8 = 1;
+  return t;
+}
+
+// Tree for a bracket expression; d->p is just past the [
+static int dfa_bracket(struct dfa *d)
+{
+  unsigned char *p = d->p;
+  int neg = *p == '^', set = dfa_set(d, 0, -1), lo, hi;
+  p += neg;
+  for (int first = 1; first || *p != ']'; first = 0) {
+    if (!*p || (*p == '[' && (p[1] == '.' || p[1] == '='))) return dfa_bad(d);
+    if (*p == '[' && p[1] == ':') {
+      int isx = !strncmp((char *)p + 2, "xdigit:]", 8);
+      if (!isx && strncmp((char *)p + 2, "digit:]", 7)) return dfa_bad(d);
+      for (lo = 0; lo < 128; lo++)
+        if (isx ? isxdigit(lo) : isdigit(lo)) d->sets[set][lo / 32] |= 1u << lo % 32;
+      p += isx ? 10 : 9;
+      continue;
+    }
+    lo = hi = *p++;
+    if (*p == '-' && p[1] && p[1] != ']') {
+      hi = p[1];
+      if (hi == '[' || hi < lo) return dfa_bad(d);
+      p += 2;
+    }
+    if (hi > 127 && d->multibyte) return dfa_bad(d);
+    for (; lo <= hi; lo++) d->sets[set][lo / 32] |= 1u << lo % 32;
+  }
+  d->p = (char *)p + 1;
+  if (!neg) return dfa_tree(d, DT_SET, set, 0);
+  for (int k = 0; k < 8; k++)
+    d->sets[set][k] = ~d->sets[set][k] & (d->multibyte && k >= 4 ? 0 : ~0u);
+  set = dfa_tree(d, DT_SET, set, 0);
+  return d->multibyte ? dfa_tree(d, DT_ALT, set, dfa_multibyte(d)) : set;
+}
+
+static int dfa_alt(struct dfa *d);
+
+static int dfa_atom(struct dfa *d)
+{
+  unsigned char c = *d->p++;
+  int t;
+  switch (c) {
+    case '(':
+      t = *d->p == ')' ? dfa_tree(d, DT_EMPTY, 0, 0) : dfa_alt(d);
+      if (*d->p++ != ')') d->bad = 1;
+      return t;
+    case '[': return dfa_bracket(d);
+    case '^': return dfa_tree(d, DT_BOL, 0, 0);
+    case '$': return dfa_tree(d, DT_EOL, 0, 0);
+    case '.':   // As in glibc, . does not match a nul byte
+      if (!d->multibyte) return dfa_tree(d, DT_SET, dfa_set(d, 1, 255), 0);
+      return dfa_tree(d, DT_ALT, dfa_tree(d, DT_SET, dfa_set(d, 1, 127), 0),
+          dfa_multibyte(d));
+    case '\\':
+      c = *d->p++;
+      if (!c || !strchr("\\^$.[]|()*+?{}", c)) return dfa_bad(d);
+      break;
+    case ')': case '*': case '+': case '?': case '{':
+      return dfa_bad(d);
+  }
+  t = dfa_tree(d, DT_SET, dfa_set(d, c, c), 0);
+  if (c < 0x80 || !d->multibyte) return t;
+  // A multibyte char is one atom, for quantifiers
+  d->check_utf8 = 1;
+  for (int k = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1; k--; ) {
+    if ((*d->p & 0xc0) != 0x80) return dfa_bad(d);
+    c = *d->p++;
+    t = dfa_tree(d, DT_CAT, t, dfa_tree(d, DT_SET, dfa_set(d, c, c), 0));
+  }
+  return t;
+}
+
+// Return nonzero if tree t has ^ or $
+static int dfa_anchored(struct dfa *d, int t)
+{
+  struct dfa_tree *tr = d->tree + t;
+  switch (tr->op) {
+    case DT_BOL: case DT_EOL: return 1;
+    case DT_CAT: case DT_ALT:
+      return dfa_anchored(d, tr->a) || dfa_anchored(d, tr->b);
+    case DT_STAR: case DT_PLUS: case DT_QUEST: case DT_REP:
+      return dfa_anchored(d, tr->a);
+  }
+  return 0;
+}
+
+static int dfa_piece(struct dfa *d)
+{
+  int t = dfa_atom(d);
+  for (char *q; !d->bad && *d->p && strchr("*+?{", *d->p); ) {
+    // glibc mishandles e.g. (^a|b){2}, so leave repeated anchors to it
+    if (dfa_anchored(d, t)) return dfa_bad(d);
+    char c = *d->p++;
+    if (c != '{') {
+      t = dfa_tree(d, c == '*' ? DT_STAR : c == '+' ? DT_PLUS : DT_QUEST, t, 0);
+      continue;
+    }
+    if (!isdigit(*d->p)) return dfa_bad(d);
+    long min = strtol(d->p, &q, 10), max = min;
+    if (*q == ',') max = isdigit(*++q) ? strtol(q, &q, 10) : -1;
+    if (*q != '}' || min > RE_DUP_MAX || max > RE_DUP_MAX
+        || (max >= 0 && max < min)) return dfa_bad(d);
+    d->p = q + 1;
+    t = dfa_tree(d, DT_REP, t, 0);
+    d->tree[t].min = min;
+    d->tree[t].max = max;
+  }
+  return t;
+}
+
+static int dfa_alt(struct dfa *d)
+{
+  int t = -1;
+  for (;;) {
+    int branch = -1;
+    while (!d->bad && *d->p && *d->p != '|' && *d->p != ')') {
+      int piece = dfa_piece(d);
+      branch = branch < 0 ? piece : dfa_tree(d, DT_CAT, branch, piece);
+    }
+    if (branch < 0) return dfa_bad(d);    // empty branch
+    t = t < 0 ? branch : dfa_tree(d, DT_ALT, t, branch);
+    if (d->bad || *d->p != '|') return t;
+    d->p++;
+  }
+}
+
+static int dfa_node(struct dfa *d, int op, int out, int out1, int set)
+{
+  if (d->nnfa == DFA_MAX_NFA) {
+    d->bad = 1;
+    return 0;
+  }
+  d->nfa = dfa_grow(d->nfa, d->nnfa, &d->nfa_cap, sizeof(*d->nfa));
+  d->nfa[d->nnfa] = (struct dfa_nfa){op, out, out1, set};
+  return d->nnfa++;
+}
+
+// Make NFA nodes for tree t, going on to node next; return first node
+static int dfa_emit(struct dfa *d, int t, int next)
+{
+  struct dfa_tree tr = d->tree[t];
+  int s, k;
+  if (d->bad) return 0;
+  switch (tr.op) {
+    case DT_SET: return dfa_node(d, DN_SET, next, -1, tr.a);
+    case DT_CAT: return dfa_emit(d, tr.a, dfa_emit(d, tr.b, next));
+    case DT_ALT:
+      return dfa_node(d, DN_SPLIT, dfa_emit(d, tr.a, next),
+          dfa_emit(d, tr.b, next), 0);
+    case DT_QUEST: return dfa_node(d, DN_SPLIT, dfa_emit(d, tr.a, next), next, 0);
+    case DT_STAR:
+    case DT_PLUS:
+      s = dfa_node(d, DN_SPLIT, -1, next, 0);
+      k = dfa_emit(d, tr.a, s);
+      if (!d->bad) d->nfa[s].out = k;
+      return tr.op == DT_STAR ? s : k;
+    case DT_REP:
+      if (tr.max < 0) {
+        s = dfa_node(d, DN_SPLIT, -1, next, 0);
+        k = dfa_emit(d, tr.a, s);
+        if (!d->bad) d->nfa[s].out = k;
+        next = s;
+      } else for (k = tr.min; k < tr.max; k++)
+        next = dfa_node(d, DN_SPLIT, dfa_emit(d, tr.a, next), next, 0);
+      for (k = 0; k < tr.min; k++) next = dfa_emit(d, tr.a, next);
+      return next;
+    case DT_BOL: return dfa_node(d, DN_BOL, next, -1, 0);
+    case DT_EOL: return dfa_node(d, DN_EOL, next, -1, 0);
+  }
+  return next;    // DT_EMPTY
+}
+
+static void dfa_free(struct dfa *d)
+{
+  if (!d) return;
+  for (int k = 0; k < d->nstates; k++) xfree(d->states[k]);
+  xfree(d->sets);
+  xfree(d->tree);
+  xfree(d->nfa);
+  xfree(d->mark);
+  xfree(d->work);
+  xfree(d);
+}
+
+// Return a DFA for ERE regex, or null if it has anything not handled
+static struct dfa *dfa_compile(char *regex)
+{
+  struct dfa *d = xzalloc(sizeof(*d));
+  d->multibyte = MB_CUR_MAX > 1;
+  d->p = regex;
+  int t = *regex ? dfa_alt(d) : dfa_tree(d, DT_EMPTY, 0, 0);
+  if (!d->bad && *d->p) d->bad = 1;   // unmatched )
+  if (!d->bad) d->start = dfa_emit(d, t, dfa_node(d, DN_MATCH, -1, -1, 0));
+  xfree(d->tree);
+  d->tree = 0;
+  if (d->bad) {
+    dfa_free(d);
+    return 0;
+  }
+  d->mark = xzalloc(d->nnfa * sizeof(*d->mark));
+  d->work = xmalloc(d->nnfa * sizeof(*d->work));
+  d->start_state[0] = d->start_state[1] = -1;
+  return d;
+}
+
+// Add NFA node n, and those reached from it without reading a byte, to
+// the set being built
+static void dfa_add(struct dfa *d, int n, int bol, int eol)
+{
+  if (d->mark[n] == d->gen) return;
+  d->mark[n] = d->gen;
+  struct dfa_nfa *x = d->nfa + n;
+  switch (x->op) {
+    case DN_SPLIT:
+      dfa_add(d, x->out, bol, eol);
+      if (x->out1 >= 0) dfa_add(d, x->out1, bol, eol);
+      return;
+    case DN_BOL:
+      if (bol) dfa_add(d, x->out, bol, eol);
+      return;
+    case DN_EOL:
+      if (eol) {
+        dfa_add(d, x->out, bol, eol);
+        return;
+      }
+      break;
+    case DN_MATCH:
+      d->reached_match = 1;
+  }
+  d->work[d->nwork++] = n;
+}
+
+static int dfa_cmp(const void *a, const void *b)
+{
+  return *(int *)a - *(int *)b;
+}
+
+// Find or make the state for the set built in d->work
+static int dfa_state(struct dfa *d, int bol)
+{
+  qsort(d->work, d->nwork, sizeof(int), dfa_cmp);
+  unsigned h = bol;
+  for (int k = 0; k < d->nwork; k++) h = h * 31 + d->work[k];
+  int slot = h & (2 * DFA_MAX_STATES - 1);
+  for (int i; (i = d->hash[slot]); slot = (slot + 1) & (2 * DFA_MAX_STATES - 1)) {
+    struct dfa_state *st = d->states[i - 1];
+    if (st->hash == h && st->bol == bol && st->n == d->nwork
+        && !memcmp(st->node, d->work, d->nwork * sizeof(int))) return i - 1;
+  }
+  struct dfa_state *st = xmalloc(sizeof(*st) + d->nwork * sizeof(int));
+  memset(st->next, -1, sizeof(st->next));
+  st->match = d->reached_match;
+  st->eol_match = -1;
+  st->bol = bol;
+  st->hash = h;
+  st->n = d->nwork;
+  memcpy(st->node, d->work, d->nwork * sizeof(int));
+  d->hash[slot] = d->nstates + 1;
+  d->states[d->nstates] = st;
+  return d->nstates++;
+}
+
+static void dfa_flush(struct dfa *d)
+{
+  for (int k = 0; k < d->nstates; k++) xfree(d->states[k]);
+  d->nstates = 0;
+  d->flushes++;
+  memset(d->hash, 0, sizeof(d->hash));
+  d->start_state[0] = d->start_state[1] = -1;
+}
+
+static void dfa_begin_set(struct dfa *d)
+{
+  if (!++d->gen) {
+    memset(d->mark, 0, d->nnfa * sizeof(*d->mark));
+    d->gen = 1;
+  }
+  d->nwork = 0;
+  d->reached_match = 0;
+}
+
+// Return the state after state si reads byte c
+static int dfa_step(struct dfa *d, int si, int c)
+{
+  struct dfa_state *st = d->states[si];
+  dfa_begin_set(d);
+  for (int k = 0; k < st->n; k++) {
+    struct dfa_nfa *x = d->nfa + st->node[k];
+    if (x->op == DN_SET && d->sets[x->set][c / 32] & 1u << c % 32)
+      dfa_add(d, x->out, 0, 0);
+  }
+  dfa_add(d, d->start, 0, 0);   // a match may also start after c
+  if (d->nstates == DFA_MAX_STATES) {
+    dfa_flush(d);
+    return dfa_state(d, 0);
+  }
+  return st->next[c] = dfa_state(d, 0);
+}
+
+// Return nonzero if s is well-formed UTF-8
+static int utf8_wellformed(unsigned char *s, unsigned char *lim)
+{
+  while (s < lim) {
+    unsigned c = *s++, n = c < 0x80 ? 0 : c < 0xc2 ? 9 : c < 0xe0 ? 1
+        : c < 0xf0 ? 2 : c < 0xf5 ? 3 : 9;
+    if (n == 9 || (size_t)(lim - s) < n) return 0;
+    // 2nd byte limits for E0, ED, F0, F4 exclude overlong forms,
+    // surrogates and code points past U+10FFFF
+    unsigned lo = c == 0xe0 ? 0xa0 : c == 0xf0 ? 0x90 : 0x80,
+             hi = c == 0xed ? 0x9f : c == 0xf4 ? 0x8f : 0xbf;
+    for (unsigned k = 0; k < n; k++, lo = 0x80, hi = 0xbf)
+      if (s[k] < lo || s[k] > hi) return 0;
+    s += n;
+  }
+  return 1;
+}
+
+// Return 0 if d matches somewhere in s (len bytes), REG_NOMATCH if not,
+// or -1 if regexec() must decide (s is not well-formed UTF-8). Return -2
+// if d has had to drop its states too often; regexec() should be used
+// from then on, and d freed.
+// eflags may have REG_NOTBOL and REG_NOTEOL.
+static int dfa_match(struct dfa *d, char *s, size_t len, int eflags)
+{
+  unsigned char *p = s, *lim = p + len;
+  int bol = !(eflags & REG_NOTBOL), si = d->start_state[bol], checked = 0;
+  if (si < 0) {
+    dfa_begin_set(d);
+    dfa_add(d, d->start, bol, 0);
+    if (d->nstates == DFA_MAX_STATES) dfa_flush(d);
+    si = d->start_state[bol] = dfa_state(d, bol);
+  }
+  struct dfa_state *st = d->states[si];
+  for (; !st->match && p < lim; p++) {
+    if (*p >= 0x80 && d->check_utf8 && !checked++
+        && !utf8_wellformed(p, lim)) return -1;
+    int ni = st->next[*p];
+    if (ni < 0) {
+      ni = dfa_step(d, si, *p);
+      if (d->flushes > DFA_MAX_FLUSHES) return -2;
+    }
+    st = d->states[si = ni];
+  }
+  if (st->match) return 0;
+  if (eflags & REG_NOTEOL) return REG_NOMATCH;
+  if (st->eol_match < 0) {
+    dfa_begin_set(d);
+    for (int k = 0; k < st->n; k++) dfa_add(d, st->node[k], st->bol, 1);
+    st->eol_match = d->reached_match;
+  }
+  return st->eol_match ? 0 : REG_NOMATCH;
+}
+
+// Return p past the bracket expression that starts just before p
+static char *skip_bracket(char *p)
+{
+  if (*p == '^') p++;
+  if (*p == ']') p++;
+  for (; *p && *p != ']'; p++)
+    if (*p == '[' && p[1] && strchr(":.=", p[1])) {
+      char *e = strchr(p + 2, p[1]);
+      while (e && e[1] != ']') e = strchr(e + 1, p[1]);
+      if (e) p = e + 1;
+    }
+  return *p ? p + 1 : p;
+}
+
+// Compile ERE regex into zr, and find in it the longest run of plain chars
+// that every match must contain (none if there is a | outside parens). If
+// the regex is nothing but that run, maybe with ^ before or $ after, it is
+// plain text. This reads regex only as far as needed for that: anything
+// not known to be plain (brackets, groups, . and \ escapes other than of
+// metachars) just ends a run, and a char made optional by * ? or {} is
+// dropped from it.
+static void zregcomp(struct zregex *zr, char *regex)
+{
+  xregcomp(&zr->rx, regex, REG_EXTENDED);
+  zr->dfa = 0;
+  size_t n = 0, best = 0;
+  char *run = xmalloc(strlen(regex) + 1), *lit = xmalloc(strlen(regex) + 1);
+  char *p = regex;
+  int plain = 1;
+  zr->bol = *p == '^';
+  zr->eol = 0;
+  p += zr->bol;
+  while (*p) {
+    int c = *p++;
+    if (c == '\\' && *p && strchr("\\^$.[]|()*+?{}", *p)) c = *p++;
+    else if (c == '|') {
+      plain = n = best = 0;
+      break;
+    } else if (c == '$' && !*p) {
+      zr->eol = 1;
+      break;
+    } else if (strchr("\\^$.[(){*?+", c)) {
+      plain = 0;
+      if (c == '\\' && *p) p++;
+      else if (c == '[') p = skip_bracket(p);
+      else if (c == '(') {
+        for (int depth = 1; *p && depth; p++) {
+          if (*p == '\\' && p[1]) p++;
+          else if (*p == '[') p = skip_bracket(p + 1) - 1;
+          else depth += (*p == '(') - (*p == ')');
+        }
+      } else if (c == '{' || c == '*' || c == '?') {
+        // Drop the char (maybe multibyte) the quantifier applies to
+        while (n && (run[n - 1] & 0xc0) == 0x80) n--;
+        if (n) n--;
+        if (c == '{') {
+          p += strcspn(p, "}");
+          if (*p) p++;
+        }
+      }
+      if (n > best) memcpy(lit, run, best = n);
+      n = 0;
+      continue;
+    }
+    run[n++] = c;
+  }
+  if (n > best) memcpy(lit, run, best = n);
+  xfree(run);
+  zr->plain = plain;
+  zr->litlen = best;
+  if (!best && !plain) {
+    xfree(lit);
+    lit = 0;
+  } else lit[best] = 0;
+  zr->lit = lit;
+  if (!plain) zr->dfa = dfa_compile(regex);
+}
+
+static void zregfree(struct zregex *zr)
+{
+  regfree(&zr->rx);
+  xfree(zr->lit);
+  dfa_free(zr->dfa);
+}
+
 ////////////////////
 //// common defs
 ////////////////////
@@ -366,12 +980,16 @@ static void get_token_text(char *op, int tk)
 ////////////////////
 
 // Return number of bytes in 'cnt' utf8 codepoints
-static int bytesinutf8(char *str, size_t len, size_t cnt)
+static size_t bytesinutf8(char *str, size_t len, size_t cnt)
 {
   if (FLAG(b)) return cnt;
   unsigned wch;
   char *lim = str + len, *s0 = str;
   while (cnt-- && str < lim) {
+    if (*str < 128) {
+      str++;
+      continue;
+    }
     int r = utf8towc(&wch, str, lim - str);
     str += r > 0 ? r : 1;
   }
@@ -379,10 +997,10 @@ static int bytesinutf8(char *str, size_t len, size_t cnt)
 }
 
 // Return number of utf8 codepoints in str
-static int utf8cnt(char *str, size_t len)
+static size_t utf8cnt(char *str, size_t len)
 {
   unsigned wch;
-  int cnt = 0;
+  size_t cnt = 0;
   char *lim;
   if (!len || FLAG(b)) return len;
   for (lim = str + len; str < lim; cnt++) {
@@ -392,6 +1010,39 @@ static int utf8cnt(char *str, size_t len)
   return cnt;
 }
 
+// Process backslash escapes in s, in place; return s. For a regex
+// (is_regex), escapes other than those of awk strings are left for regcomp().
+static char *escape_str(char *s, int is_regex)
+{
+  char *p, *escapes = is_regex ? "abfnrtv\"/" : "\\abfnrtv\"/";
+  // FIXME TODO should / be in there?
+  char *s0 = s, *to = s;
+  while ((*to = *s)) {
+    if (*s != '\\') { to++, s++;
+    } else if ((p = strchr(escapes, *++s))) {
+      // checking char after \ for known escapes
+      int c = (is_regex?"\a\b\f\n\r\t\v\"/":"\\\a\b\f\n\r\t\v\"/")[p-escapes];
+      if (c) *to = c, s++;  // else final backslash
+      to++;
+    } else if ('0' <= *s && *s <= '9') {
+      int k, c = *s++ - '0';
+      for (k = 0; k < 2 && '0' <= *s && *s <= '9'; k++)
+        c = c * 8 + *s++ - '0';
+      *to++ = c;
+    } else if (*s == 'x') {
+      if (isxdigit(s[1])) {
+        int c = hexval(*++s);
+        if (isxdigit(s[1])) c = c * 16 + hexval(*++s);
+        *to++ = c, s++;
+      }
+    } else {
+      if (is_regex) *to++ = '\\';
+      *to++ = *s++;
+    }
+  }
+  return s0;
+}
+
 ////////////////////
 ////   zlist
 ////////////////////
@@ -489,11 +1140,6 @@ static struct zstring *zstring_update(struct zstring *to, size_t at, char *s, si
   return zstring_modify(to, at, s, n);
 }
 
-static struct zstring *zstring_copy(struct zstring *to, struct zstring *from)
-{
-  return zstring_update(to, 0, from->str, from->size);
-}
-
 static struct zstring *zstring_extend(struct zstring *to, struct zstring *from)
 {
   return zstring_update(to, to->size, from->str, from->size);
@@ -549,13 +1195,6 @@ static void zvalue_copy(struct zvalue *to, struct zvalue *from)
   }
 }
 
-static void zvalue_dup_zstring(struct zvalue *v)
-{
-  struct zstring *z = new_zstring(v->vst->str, v->vst->size);
-  zstring_release(&v->vst);
-  v->vst = z;
-}
-
 ////////////////////
 ////   zmap (array) implementation
 ////////////////////
@@ -621,6 +1260,7 @@ static void zmap_init(struct zmap *m)
   m->limit = INIT_SIZE * 8 / 10;
   m->count = 0;
   m->deleted = 0;
+  m->split_cnt = 0;
   zlist_init(&m->slot, sizeof(struct zmap_slot));
 }
 
@@ -688,11 +1328,30 @@ static struct zmap_slot *zmap_find_or_insert_key(struct zmap *m, struct zstring
   struct zmap_slot zs = ZMSLOTINIT(hash, key, (struct zvalue)ZVINIT(0, 0.0, 0));
   zstring_incr_refcnt(key);
   int n = zlist_append(&m->slot, &zs);
-  m->count++;
+  if (m->hash[probe] < 0) m->deleted--;   // reusing a deleted entry
+  else m->count++;
   m->hash[probe] = n + 1;
+  m->split_cnt = 0;
   return &MAPSLOT[n];
 }
 
+// Delete all but the first n slots, which must be the most recently
+// inserted; used to shrink the elements of a reused split() array.
+static void zmap_truncate(struct zmap *m, int n)
+{
+  int hash, probe;
+  for (struct zmap_slot *p = &MAPSLOT[n]; p < &MAPSLOT[zlist_len(&m->slot)]; p++) {
+    if (!p->key) continue;
+    find_mapslot(m, p->key, &hash, &probe);
+    m->hash[probe] = -1;
+    m->deleted++;
+    zstring_release(&p->key);
+    zvalue_release_zstring(&p->val);
+  }
+  m->slot.avail = m->slot.base + n * m->slot.size;
+  m->split_cnt = 0;
+}
+
 static void zmap_delete(struct zmap *m, struct zstring *key)
 {
   int hash, probe;
@@ -701,6 +1360,27 @@ static void zmap_delete(struct zmap *m, struct zstring *key)
   zstring_release(&MAPSLOT[m->hash[probe] - 1].key);
   m->hash[probe] = -1;
   m->deleted++;
+  m->split_cnt = 0;
+}
+
+// File table: each file or command name used in an i/o redirection gets a
+// fixed slot number, kept in TT.file_map as the value for the name. The
+// open zfile for the name (if any) is in FILESLOT[slot].zfp. Slots are never
+// reused, so a constant name can be given its slot at compile time.
+static int file_slot(struct zstring *name)
+{
+  struct zmap *m = TT.file_map;
+  if (!m) {
+    m = TT.file_map = xmalloc(sizeof(*m));
+    zmap_init(m);
+    zlist_init(&TT.file_slots, sizeof(struct file_slot));
+  }
+  struct zmap_slot *x = zmap_find_or_insert_key(m, name);
+  if (!x->val.flags) {
+    struct file_slot fs = {0, x->key};
+    x->val = (struct zvalue)ZVINIT(ZF_NUM, zlist_append(&TT.file_slots, &fs), 0);
+  }
+  return (int)x->val.num;
 }
 
 ////////////////////
@@ -1123,9 +1803,8 @@ static int make_literal_str_val(char *s)
 
 static int make_literal_regex_val(char *s)
 {
-  regex_t *rx;
-  rx = xmalloc(sizeof(*rx));
-  xregcomp(rx, s, REG_EXTENDED);
+  struct zregex *rx = xmalloc(sizeof(*rx));
+  zregcomp(rx, s);
   struct zvalue v = ZVINIT(ZF_RX, 0, 0);
   v.rx = rx;
   // Flag empty rx to make it easy to identify for split() special case
@@ -1133,6 +1812,20 @@ static int make_literal_regex_val(char *s)
   return zlist_append(&TT.literals, &v);
 }
 
+// If the code from zcode_start on is just a string constant, used as a
+// regex (by ~ !~ match() sub() gsub()), compile it now as a literal regex
+// instead of at each use. Not for split(), where a string that is a
+// single char or has no regex metachars is matched without a regex.
+static void promote_str_to_regex(int zcode_start)
+{
+  if (TT.zcode_last != zcode_start + 2 || ZCODE[zcode_start + 1] != tkstring)
+    return;
+  char *s = escape_str(xstrdup(LITERAL[ZCODE[TT.zcode_last]].vst->str), 1);
+  ZCODE[zcode_start + 1] = tkregex;
+  ZCODE[TT.zcode_last] = make_literal_regex_val(s);
+  xfree(s);
+}
+
 static int make_literal_num_val(double num)
 {
   struct zvalue v = ZVINIT(ZF_NUM, num, 0);
@@ -1202,6 +1895,7 @@ static int find_or_add_var_name(void)
     globals_ent = find_global(TT.tokstr);
     if (!globals_ent) globals_ent = add_global(TT.tokstr);
     slotnum = globals_ent;
+    if (slotnum == NF) TT.nf_ref = 1;   // records must be split in full
     if (find_func_def_entry(TT.tokstr))
       // POSIX: The same name shall not be used both as a variable name
       // with global scope and as the name of a function.
@@ -1251,7 +1945,7 @@ static void init_compiler(void)
   // Special variables (POSIX). Must align with enum spec_var_names
   static char *spec_vars[] = { "ARGC", "ARGV", "CONVFMT", "ENVIRON", "FILENAME",
       "FNR", "FS", "NF", "NR", "OFMT", "OFS", "ORS", "RLENGTH", "RS", "RSTART",
-      "SUBSEP", 0};
+      "SUBSEP", "FIELDWIDTHS", "RECLEN", 0};
 
   init_tables();
   for (int k = 0; spec_vars[k]; k++) {
@@ -1438,7 +2132,11 @@ static void builtin_call(int tk, char *builtin_name)
       if (ISTOK(tkregex)) {
         gen2cd(tkregex, make_literal_regex_val(TT.tokstr));
         scan();
-      } else expr(0);
+      } else {
+        int zcode_start = TT.zcode_last;
+        expr(0);
+        promote_str_to_regex(zcode_start);
+      }
       expect(tkcomma);
       optional_nl();
       expr(0);
@@ -1458,7 +2156,11 @@ static void builtin_call(int tk, char *builtin_name)
       if (ISTOK(tkregex)) {
         gen2cd(tkregex, make_literal_regex_val(TT.tokstr));
         scan();
-      } else expr(0);
+      } else {
+        int zcode_start = TT.zcode_last;
+        expr(0);
+        promote_str_to_regex(zcode_start);
+      }
       num_args = 2;
       break;
 
@@ -1611,12 +2313,18 @@ static void field_op(void)
 {
   // CURTOK() must be $ here.
   expect(tkfield);
+  int cdx = TT.zcode_last;
   // tkvar, tknumber, tkstring, tkregex, tkfunc, tkbuiltin, tkfield, tkminus,
   // tkplus, tknot, tkincr, tkdecr, tklparen, tkgetline, tkclose, tkindex,
   // tkmatch, tksplit, tksub, tkgsub, tksprintf, tksubstr
   if (ISTOK(tkfield)) field_op();
   else if (ISTOK(tkvar)) var();
   else primary();
+  // Note how far records need splitting for this; see split_fields()
+  if (TT.zcode_last == cdx + 2 && ZCODE[cdx + 1] == tknumber) {
+    double n = LITERAL[ZCODE[cdx + 2]].num;
+    if (n > TT.field_max) TT.field_max = n < INT_MAX ? n : INT_MAX;
+  } else TT.field_dyn = 1;
   // tkfield op has "dummy" 2nd word so that convert_push_to_reference(void)
   // can find either tkfield or tkvar at same place (ZCODE[TT.zcode_last-1]).
   gen2cd(tkfield, tkeof);
@@ -1661,6 +2369,20 @@ static void lvalue(void)
   }
 }
 
+// Compile the file name (or command) of an i/o redirection. If it is just a
+// string constant, it gets its file table slot now instead, so the run time
+// does not stack and look up the name every time. Returns the slot, or -1.
+static int redir_target(int rbp)
+{
+  int cdx = TT.zcode_last;
+  expr(rbp);
+  if (TT.zcode_last != cdx + 2 || ZCODE[cdx + 1] != tkstring) return -1;
+  int slot = file_slot(LITERAL[ZCODE[cdx + 2]].vst);
+  TT.zcode.avail -= 2 * TT.zcode.size;    // drop the tkstring instruction
+  TT.zcode_last = cdx;
+  return slot;
+}
+
 static int primary(void)
 {
   //  On entry: CURTOK() is first token of expression
@@ -1688,7 +2410,7 @@ static int primary(void)
   //      num, string, regex, var, var with subscripts, and function calls
 
   int num_exprs = 0;
-  int nargs, modifier;
+  int nargs, modifier, slot = -1;
   int tok = CURTOK();
   switch (tok) {
     case tkvar:
@@ -1774,12 +2496,12 @@ static int primary(void)
         nargs++;
       }
       if (havetok(tklt)) {
-        expr(getrbp(tkcat));   // bwk "historical practice" precedence
-        nargs++;
+        // bwk "historical practice" precedence
+        if ((slot = redir_target(getrbp(tkcat))) < 0) nargs++;
         modifier = tklt;
       }
       gen2cd(tkgetline, nargs);
-      gencd(modifier);
+      gen2cd(modifier, slot);
       break;
 
     default:
@@ -1818,7 +2540,7 @@ static void binary_op(int optor)  // Also for ternary ?: optor.
         nargs++;
       }
       gen2cd(tkgetline, nargs);
-      gencd(tkpipe);
+      gen2cd(tkpipe, -1);
       break;
 
   case tkand:
@@ -1845,8 +2567,10 @@ static void binary_op(int optor)  // Also for ternary ?: optor.
 
   case tkmatchop:
   case tknotmatch:
+      cdx = TT.zcode_last;
       expr(rbp);
       if (ZCODE[TT.zcode_last - 1] == opmatchrec) ZCODE[TT.zcode_last - 1] = tkregex;
+      promote_str_to_regex(cdx);
       gencd(optor);
       break;
 
@@ -1926,7 +2650,7 @@ static int expr(int rbp)
 static void print_stmt(int tk)
 {
   static char outmodes[] = {tkgt, tkappend, tkpipe, 0};
-  int num_exprs = 0, outmode;
+  int num_exprs = 0, outmode, slot = -1;
   TT.cgl.in_print_stmt = 1;
   expect(tk); // tkprint or tkprintf
   if ((tk == tkprintf) || !strchr(printexprendsy, CURTOK())) {
@@ -1942,11 +2666,11 @@ static void print_stmt(int tk)
   outmode = CURTOK();
   if (strchr(outmodes, outmode)) {
     scan();
-    expr(0); // FIXME s/b only bwk term? check POSIX
-    num_exprs++;
+    // FIXME s/b only bwk term? check POSIX
+    if ((slot = redir_target(0)) < 0) num_exprs++;
   } else outmode = 0;
   gen2cd(tk, num_exprs);
-  gencd(outmode);
+  gen2cd(outmode, slot);
   TT.cgl.in_print_stmt = 0;
 }
 
@@ -2480,65 +3204,139 @@ static void compile(void)
 //// runtime
 ////////////////////
 
+static char decimal_dot;  // LC_NUMERIC decimal point is '.'
+
+static double p10[] = {1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+  1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+
+// strtod(), but fast for plain decimal numbers of up to 15 digits, which
+// are converted exactly (integer / power of ten rounds correctly).
+static double str_to_num(char *s, char **end)
+{
+  char *p = s;
+  unsigned long long m = 0;
+  int nd = 0, nf = 0;
+  while (isspace(*p)) p++;
+  int neg = *p == '-';
+  if (*p == '-' || *p == '+') p++;
+  for (; isdigit(*p); p++, nd++) m = m * 10 + *p - '0';
+  if (*p == '.' && decimal_dot)
+    for (p++; isdigit(*p); p++, nd++, nf++) m = m * 10 + *p - '0';
+  // No digits (maybe inf or nan), too many, exponent, hex, or locale
+  // decimal point not '.'; let strtod() do it.
+  if (!nd || nd > 15 || (*p && strchr("eExX", *p)) || !decimal_dot)
+    return strtod(s, end);
+  *end = p;
+  double r = nf ? m / p10[nf] : m;
+  return neg ? -r : r;
+}
+
+// Flag a string from input etc. as possibly a "numeric string" (POSIX),
+// to be checked by numstr_check() if and when it matters.
 static void check_numeric_string(struct zvalue *v)
 {
-  if (v->vst) {
-    char *end, *s = v->vst->str;
-    // Significant speed gain with this test:
-    // num string must begin space, +, -, ., or digit.
-    if (strchr("+-.1234567890 ", *s)) {
-      double num = strtod(s, &end);
-      if (s == end || end[strspn(end, " ")]) return;
-      v->num = num;
-      v->flags |= ZF_NUM | ZF_STR | ZF_NUMSTR;
-    }
+  if (v->vst) v->flags |= ZF_NUMCHK;
+}
+
+static void numstr_check(struct zvalue *v)
+{
+  if (!(v->flags & ZF_NUMCHK)) return;
+  v->flags &= ~ZF_NUMCHK;
+  char *end, *s = v->vst->str;
+  // Significant speed gain with this test:
+  // num string must begin space, +, -, ., or digit.
+  if (strchr("+-.1234567890 ", *s)) {
+    double num = str_to_num(s, &end);
+    if (s == end || end[strspn(end, " ")]) return;
+    v->num = num;
+    v->flags |= ZF_NUM | ZF_STR | ZF_NUMSTR;
   }
 }
 
-static struct zstring *num_to_zstring(double n, char *fmt)
+// Write digits of u, ending at e; return start
+static char *ulong_digits(char *e, unsigned long long u, int base)
+{
+  do *--e = "0123456789abcdef"[u % base]; while (u /= base);
+  return e;
+}
+
+// Format non-integer n as "%.6g" (the default CONVFMT and OFMT) does,
+// into buf; return length, or 0 if it might not round exactly as
+// snprintf() would (then snprintf() must do it).
+static int g6_digits(char *buf, double n)
+{
+  double a = fabs(n), t = 0;
+  char d[6], *p = buf;
+  int e, k, tries = 0, nd = 6;
+  if (!(a >= 1e-5 && a < 1e15) || !decimal_dot) return 0;
+  // Scale to 6 digits before the point: 1e5 <= t < 1e6
+  for (e = (int)floor(log10(a)); tries++ < 3; ) {
+    k = 5 - e;
+    t = k >= 0 ? a * p10[k] : a / p10[-k];
+    if (t < 1e5) e--;
+    else if (t >= 1e6) e++;
+    else break;
+  }
+  // t is within t * 2^-53 of the exact value; give up near a rounding tie
+  double fl = floor(t), fr = t - fl;
+  if (tries > 3 || fabs(fr - 0.5) <= t * 0x1p-52) return 0;
+  long r = fl + (fr > 0.5);
+  if (r == 1000000) r = 100000, e++;
+  for (k = 5; k >= 0; k--, r /= 10) d[k] = '0' + r % 10;
+  while (nd > 1 && d[nd-1] == '0') nd--;
+  if (n < 0) *p++ = '-';
+  if (e < -4 || e >= 6) {
+    *p++ = d[0];
+    if (nd > 1) *p++ = '.';
+    memcpy(p, d + 1, nd - 1);
+    p += nd - 1;
+    *p++ = 'e';
+    *p++ = e < 0 ? '-' : '+';
+    *p++ = '0' + abs(e) / 10;
+    *p++ = '0' + abs(e) % 10;
+  } else if (e < 0) {
+    *p++ = '0';
+    *p++ = '.';
+    for (k = -1; k > e; k--) *p++ = '0';
+    memcpy(p, d, nd);
+    p += nd;
+  } else {
+    for (k = 0; k <= e; k++) *p++ = k < nd ? d[k] : '0';
+    if (nd > e + 1) *p++ = '.';
+    for (; k < nd; k++) *p++ = d[k];
+  }
+  return p - buf;
+}
+
+// Format n into buf (PBUFSIZE bytes) as a string for CONVFMT/OFMT fmt;
+// return length.
+static int num_to_buf(char *buf, double n, char *fmt)
 {
   int k;
-  if (n == (long long)n) k = snprintf(TT.pbuf, PBUFSIZE, "%lld", (long long)n);
-  else k = snprintf(TT.pbuf, PBUFSIZE, fmt, n);
+  if (n == (long long)n) {
+    long long m = n;
+    unsigned long long u = m < 0 ? -(unsigned long long)m : (unsigned long long)m;
+    char *e = buf + PBUFSIZE, *s = ulong_digits(e, u, 10);
+    if (m < 0) *--s = '-';
+    memmove(buf, s, k = e - s);
+    return k;
+  }
+  if (fmt[0] == '%' && !strcmp(fmt, "%.6g") && (k = g6_digits(buf, n)))
+    return k;
+  k = snprintf(buf, PBUFSIZE, fmt, n);
   if (k < 0 || k >= PBUFSIZE) FFATAL("error encoding %f via '%s'", n, fmt);
-  return new_zstring(TT.pbuf, k);
+  return k;
+}
+
+static struct zstring *num_to_zstring(double n, char *fmt)
+{
+  return new_zstring(TT.pbuf, num_to_buf(TT.pbuf, n, fmt));
 }
 
 ////////////////////
 //// regex routines
 ////////////////////
 
-static char *escape_str(char *s, int is_regex)
-{
-  char *p, *escapes = is_regex ? "abfnrtv\"/" : "\\abfnrtv\"/";
-  // FIXME TODO should / be in there?
-  char *s0 = s, *to = s;
-  while ((*to = *s)) {
-    if (*s != '\\') { to++, s++;
-    } else if ((p = strchr(escapes, *++s))) {
-      // checking char after \ for known escapes
-      int c = (is_regex?"\a\b\f\n\r\t\v\"/":"\\\a\b\f\n\r\t\v\"/")[p-escapes];
-      if (c) *to = c, s++;  // else final backslash
-      to++;
-    } else if ('0' <= *s && *s <= '9') {
-      int k, c = *s++ - '0';
-      for (k = 0; k < 2 && '0' <= *s && *s <= '9'; k++)
-        c = c * 8 + *s++ - '0';
-      *to++ = c;
-    } else if (*s == 'x') {
-      if (isxdigit(s[1])) {
-        int c = hexval(*++s);
-        if (isxdigit(s[1])) c = c * 16 + hexval(*++s);
-        *to++ = c, s++;
-      }
-    } else {
-      if (is_regex) *to++ = '\\';
-      *to++ = *s++;
-    }
-  }
-  return s0;
-}
-
 static void force_maybemap_to_scalar(struct zvalue *v)
 {
   if (!(v->flags & ZF_ANYMAP)) return;
@@ -2554,22 +3352,57 @@ static void force_maybemap_to_map(struct zvalue *v)
 }
 
 // fmt_offs is either CONVFMT or OFMT (offset in stack to zvalue)
+static char *fmt_str(int fmt_offs)
+{
+  if (!IS_STR(&STACK[fmt_offs])) {
+    zstring_release(&STACK[fmt_offs].vst);
+    STACK[fmt_offs].vst = num_to_zstring(STACK[fmt_offs].num, "%.6g");
+    STACK[fmt_offs].flags = ZF_STR;
+  }
+  return STACK[fmt_offs].vst->str;
+}
+
+// Numbers recently converted to strings, with the CONVFMT or OFMT zstring
+// they were formatted under, so a value used over and over as a string is
+// converted (and allocated) just once. Entries hold references, so a
+// format zstring can't be freed and its address reused while cached.
+#define NUMSTR_MEMO_BITS 6
+static struct numstr_memo {
+  double num;
+  struct zstring *fmt, *str;
+} numstr_memo[1 << NUMSTR_MEMO_BITS];
+
+static struct zstring *num_to_zstring_memo(double n, int fmt_offs)
+{
+  char *fmt = fmt_str(fmt_offs);
+  struct zstring *fz = STACK[fmt_offs].vst;
+  unsigned long long u;
+  memcpy(&u, &n, sizeof(u));
+  struct numstr_memo *m = numstr_memo +
+      ((u ^ u >> 32) * 0x9e3779b97f4a7c15ull >> (64 - NUMSTR_MEMO_BITS));
+  // Compare bits, not values: -0 and 0 differ, and a NaN matches itself
+  if (m->fmt != fz || memcmp(&m->num, &n, sizeof(n))) {
+    zstring_release(&m->fmt);
+    zstring_release(&m->str);
+    m->num = n;
+    zstring_incr_refcnt(m->fmt = fz);
+    m->str = num_to_zstring(n, fmt);
+  }
+  zstring_incr_refcnt(m->str);
+  return m->str;
+}
+
 static struct zvalue *to_str_fmt(struct zvalue *v, int fmt_offs)
 {
   force_maybemap_to_scalar(v);
   // TODO: consider handling numstring differently
-  if (v->flags & ZF_NUMSTR) v->flags = ZF_STR;
+  if (v->flags & (ZF_NUMSTR | ZF_NUMCHK)) v->flags = ZF_STR;
   if (IS_STR(v)) return v;
   else if (!v->flags) { // uninitialized
     v->vst = new_zstring("", 0);
   } else if (IS_NUM(v)) {
     zvalue_release_zstring(v);
-    if (!IS_STR(&STACK[fmt_offs])) {
-      zstring_release(&STACK[fmt_offs].vst);
-      STACK[fmt_offs].vst = num_to_zstring(STACK[fmt_offs].num, "%.6g");
-      STACK[fmt_offs].flags = ZF_STR;
-    }
-    v->vst = num_to_zstring(v->num, STACK[fmt_offs].vst->str);
+    v->vst = num_to_zstring_memo(v->num, fmt_offs);
   } else {
     FATAL("Wrong or unknown type in to_str_fmt\n");
   }
@@ -2585,41 +3418,139 @@ static struct zvalue *to_str(struct zvalue *v)
 // TODO FIXME Is this needed? (YES -- investigate) Just use to_str()?
 #define ENSURE_STR(v) (IS_STR(v) ? (v) : to_str(v))
 
-static void rx_zvalue_compile(regex_t **rx, struct zvalue *pat)
+// regexec0() on len bytes at s, setting *start and *end if not null.
+// regoff_t may be an int, so a longer s is searched in windows of INT_MAX
+// bytes, each starting halfway into the one before; a match is taken from
+// the window in whose first half it starts. A match reaching the end of
+// its window may have been cut short there, so is an error.
+static int rx_exec(regex_t *rx, char *s, size_t len, size_t *start,
+    size_t *end, int eflags)
 {
-  if (IS_RX(pat)) *rx = pat->rx;
-  else {
-    zvalue_dup_zstring(to_str(pat));
-    escape_str(pat->vst->str, 1);
-    xregcomp(*rx, pat->vst->str, REG_EXTENDED);
+  regmatch_t m;
+  size_t off = 0, half = INT_MAX / 2;
+  int r;
+  while (REG_STARTEND && sizeof(regoff_t) < sizeof(len)
+      && len - off > INT_MAX) {
+    r = regexec0(rx, s + off, INT_MAX, 1, &m, eflags | REG_NOTEOL);
+    if (r != REG_NOMATCH && (r || (size_t)m.rm_so < half)) {
+      if (!r && m.rm_eo == INT_MAX) FATAL("regex match too long");
+      if (!r && start) *start = off + m.rm_so, *end = off + m.rm_eo;
+      return r;
+    }
+    off += half;
+    eflags |= REG_NOTBOL;
   }
+  r = regexec0(rx, s + off, len - off, !!start, &m, eflags);
+  if (!r && start) *start = off + m.rm_so, *end = off + m.rm_eo;
+  return r;
 }
 
-static void rx_zvalue_free(regex_t *rx, struct zvalue *pat)
+// Regexes compiled from strings (dynamic regexes, and regex FS values) are
+// kept, so that e.g. $0 ~ pat in a rule does not compile pat per record.
+// An entry is found by the pattern as given and whether awk escapes in it
+// are processed first (as for a dynamic regex; see escape_str()). When the
+// cache is full, the least recently used entry is replaced.
+#define RX_CACHE_MAX 16
+struct rx_cache {
+  struct zstring *pat;  // held, so it is not modified in place
+  int escapes;
+  unsigned long last;   // TT.rx_cache_tick when last used
+  struct zregex rx;
+};
+
+static struct zregex *rx_cached(struct zstring *pat, int escapes)
 {
-  if (!IS_RX(pat) || rx != pat->rx) regfree(rx);
+  struct rx_cache *c = TT.rx_cache, *lru;
+  if (!c) c = TT.rx_cache = xzalloc(RX_CACHE_MAX * sizeof(*c));
+  lru = c;
+  for (int k = 0; k < RX_CACHE_MAX; k++, c++) {
+    if (c->pat && c->escapes == escapes
+        && (c->pat == pat || zstring_match(c->pat, pat))) {
+      c->last = ++TT.rx_cache_tick;
+      return &c->rx;
+    }
+    if (c->last < lru->last) lru = c;
+  }
+  if (lru->pat) {
+    zregfree(&lru->rx);
+    zstring_release(&lru->pat);
+  }
+  char *s = escapes ? escape_str(xstrdup(pat->str), 1) : pat->str;
+  zregcomp(&lru->rx, s);
+  if (escapes) xfree(s);
+  zstring_incr_refcnt(lru->pat = pat);
+  lru->escapes = escapes;
+  lru->last = ++TT.rx_cache_tick;
+  return &lru->rx;
 }
 
-// Used by the match/not match ops (~ !~) and implicit $0 match (/regex/)
-static int match(struct zvalue *zvsubject, struct zvalue *zvpat)
+static void rx_cache_free(void)
 {
-  int r;
-  regex_t rx, *rxp = &rx;
-  rx_zvalue_compile(&rxp, zvpat);
-  if ((r = regexec(rxp, to_str(zvsubject)->vst->str, 0, 0, 0)) != 0) {
-    if (r != REG_NOMATCH) {
-      char errbuf[256];
-      regerror(r, &rx, errbuf, sizeof(errbuf));
-      // FIXME TODO better diagnostic here
-      error_exit("regex match error %d: %s", r, errbuf);
+  for (int k = 0; TT.rx_cache && k < RX_CACHE_MAX; k++)
+    if (TT.rx_cache[k].pat) {
+      zregfree(&TT.rx_cache[k].rx);
+      zstring_release(&TT.rx_cache[k].pat);
     }
-    rx_zvalue_free(rxp, zvpat);
-    return 1;
+  xfree(TT.rx_cache);
+}
+
+// Return the regex for pat: a literal /regex/, or a string as a dynamic
+// regex (compiled on first use; see rx_cached())
+static struct zregex *rx_zvalue_compile(struct zvalue *pat)
+{
+  return IS_RX(pat) ? pat->rx : rx_cached(to_str(pat)->vst, 1);
+}
+
+// Decide quickly if zr matches s (len bytes), if zr is plain text, or s
+// lacks the text every match must contain (see zregcomp()), or else by its
+// DFA. Return 0 if zr matched (setting *start and *end if start is not
+// null, which a DFA cannot do), REG_NOMATCH if zr cannot match, or -1 if
+// regexec() must decide.
+static int rx_quick(struct zregex *zr, char *s, size_t len, size_t *start,
+    size_t *end, int eflags)
+{
+  size_t m = zr->litlen;
+  char *p;
+  if (!zr->plain) {
+    if (zr->lit && !mem_find(s, len, zr->lit, m)) return REG_NOMATCH;
+    int r = zr->dfa ? dfa_match(zr->dfa, s, len, eflags) : -1;
+    if (r == -2) {    // DFA keeps running out of states
+      dfa_free(zr->dfa);
+      zr->dfa = 0;
+    }
+    return r == REG_NOMATCH || (!r && !start) ? r : -1;
   }
-  rx_zvalue_free(rxp, zvpat);
+  if (len < m || (zr->bol && (eflags & REG_NOTBOL))
+      || (zr->eol && (eflags & REG_NOTEOL)) || (zr->bol && zr->eol && len != m))
+    return REG_NOMATCH;
+  p = zr->bol ? s : zr->eol ? s + len - m : mem_find(s, len, zr->lit, m);
+  if (!p || memcmp(p, zr->lit, m)) return REG_NOMATCH;
+  if (start) *start = p - s, *end = p - s + m;
   return 0;
 }
 
+// Match s against zvpat; s is len bytes, or null-terminated if len < 0
+static int match_str(char *s, long len, struct zvalue *zvpat)
+{
+  struct zregex *zr = rx_zvalue_compile(zvpat);
+  int r = rx_quick(zr, s, len < 0 ? strlen(s) : (size_t)len, 0, 0, 0);
+  if (r < 0) r = len < 0 ? regexec(&zr->rx, s, 0, 0, 0)
+      : rx_exec(&zr->rx, s, len, 0, 0, 0);
+  if (r && r != REG_NOMATCH) {
+    char errbuf[256];
+    regerror(r, &zr->rx, errbuf, sizeof(errbuf));
+    // FIXME TODO better diagnostic here
+    error_exit("regex match error %d: %s", r, errbuf);
+  }
+  return !!r;
+}
+
+// Used by the match/not match ops (~ !~) and implicit $0 match (/regex/)
+static int match(struct zvalue *zvsubject, struct zvalue *zvpat)
+{
+  return match_str(to_str(zvsubject)->vst->str, -1, zvpat);
+}
+
 static int rx_find(regex_t *rx, char *s, regoff_t *start, regoff_t *end, int eflags)
 {
   regmatch_t matches[1];
@@ -2631,19 +3562,41 @@ static int rx_find(regex_t *rx, char *s, regoff_t *start, regoff_t *end, int efl
   return 0;
 }
 
+// Like rx_find() for zr, but trying rx_quick() first; s is null-terminated
+// and len is strlen(s).
+static int zrx_find(struct zregex *zr, char *s, size_t len, regoff_t *start,
+    regoff_t *end, int eflags)
+{
+  size_t so, eo;
+  int r = rx_quick(zr, s, len, &so, &eo, eflags);
+  if (r < 0) return rx_find(&zr->rx, s, start, end, eflags);
+  if (!r) *start = so, *end = eo;
+  return r;
+}
+
+// Like rx_find() but s is len bytes, not null-terminated if REG_STARTEND
+static int rx_findn(regex_t *rx, char *s, size_t len, size_t *start,
+    size_t *end, int eflags)
+{
+  int r = rx_exec(rx, s, len, start, end, eflags);
+  if (r && r != REG_NOMATCH) FATAL("regexec error");
+  return r;
+}
+
 // Differs from rx_find() in that FS cannot match null (empty) string.
 // See https://www.austingroupbugs.net/view.php?id=1468.
-static int rx_find_FS(regex_t *rx, char *s, regoff_t *start, regoff_t *end, int eflags)
+static int rx_find_FS(regex_t *rx, char *s, size_t len, size_t *start,
+    size_t *end, int eflags)
 {
-  int r = rx_find(rx, s, start, end, eflags);
+  int r = rx_findn(rx, s, len, start, end, eflags);
   if (r || *start != *end) return r;  // not found, or found non-empty match
   // Found empty match, retry starting past the match
-  char *p = s + *end;
-  if (!*p) return REG_NOMATCH;  // End of string, no non-empty match found
+  char *p = s + *end, *lim = s + len;
+  if (p == lim) return REG_NOMATCH;  // End of string, no non-empty match found
   // Empty match not at EOS, move ahead and try again
-  while (!r && *start == *end && *++p)
-    r = rx_find(rx, p, start, end, eflags);
-  if (r || !*p) return REG_NOMATCH;  // no non-empty match found
+  while (!r && *start == *end && ++p < lim)
+    r = rx_findn(rx, p, lim - p, start, end, eflags);
+  if (r || p == lim) return REG_NOMATCH;  // no non-empty match found
   *start += p - s;  // offsets from original string
   *end += p - s;
   return 0;
@@ -2653,48 +3606,119 @@ static int rx_find_FS(regex_t *rx, char *s, regoff_t *start, regoff_t *end, int
 ////   fields
 ////////////////////
 
-#define FIELDS_MAX  102400 // Was 1024; need more for toybox awk test
-#define THIS_MEANS_SET_NF 999999999
+#define THIS_MEANS_SET_NF INT_MAX  // so not a valid field number
+
+// Check and convert field number (or NF value)
+static int to_field_num(double n)
+{
+  if (!(n >= 0 && n < THIS_MEANS_SET_NF)) FFATAL("bad field num %.0f\n", n);
+  return n;
+}
 
 static int get_int_val(struct zvalue *v)
 {
-  if (IS_NUM(v)) return (int)v->num;
-  if (IS_STR(v) && v->vst) return (int)atof(v->vst->str);
+  char *s;
+  if (IS_NUM(v)) return to_field_num(v->num);
+  if (IS_STR(v) && v->vst) return to_field_num(str_to_num(v->vst->str, &s));
   return 0;
 }
 
-// A single-char FS is never a regex, so make it a [<char>] regex to
-// match only that one char in case FS is a regex metachar.
-// If regex FS is needed, must use > 1 char. If a '.' regex
-// is needed, use e.g. '.|.' (unlikely case).
-static char *fmt_one_char_fs(char *fs)
-{
-  if (strlen(fs) != 1) return fs;
-  snprintf(TT.one_char_fs, sizeof(TT.one_char_fs), "[%c]", fs[0]);
-  return TT.one_char_fs;
+// FS matcher types. Only a real regex FS is compiled (by rx_cached());
+// the others are scanned for directly. The matcher is rebuilt only when
+// FS changes.
+enum fs_modes { FS_SPACE = 1, FS_BYTE, FS_LITERAL, FS_CLASS, FS_REGEX };
+
+// Set TT.fs_set to the bytes of a simple bracket expression fs, e.g. "[,;]"
+// or "[a-z:]", optionally followed by +. Return 0 if fs is not one (has a
+// leading ^ or ], backslash, nested [, non-ASCII char, etc.).
+static int fs_class_prep(char *fs)
+{
+  unsigned char *p = fs + 1;
+  if (*fs != '[' || *p == '^' || *p == ']') return 0;
+  memset(TT.fs_set, 0, sizeof(TT.fs_set));
+  for (; *p != ']'; p++) {
+    int lo = *p, hi = *p;
+    if (!lo || lo == '\\' || lo == '[' || lo > 127) return 0;
+    if (p[1] == '-' && p[2] != ']') {
+      hi = p[2];
+      if (!hi || hi == '\\' || hi == '[' || hi > 127 || hi < lo) return 0;
+      p += 2;
+    }
+    while (lo <= hi) TT.fs_set[lo++] = 1;
+  }
+  TT.fs_run = p[1] == '+';
+  return !p[1 + TT.fs_run];
 }
 
-static regex_t *rx_fs_prep(char *fs)
+// Set up FS matcher for fs; return FS mode.
+static int fs_prep(char *fs)
 {
-  if (!strcmp(fs, " ")) return &TT.rx_default;
-  if (!strcmp(fs, TT.fs_last)) return &TT.rx_last;
+  if (!strcmp(fs, " ")) return FS_SPACE;
+  if (!strcmp(fs, TT.fs_last)) return TT.fs_mode;
   if (strlen(fs) >= FS_MAX) FATAL("FS too long");
   strcpy(TT.fs_last, fs);
-  regfree(&TT.rx_last);
-  xregcomp(&TT.rx_last, fmt_one_char_fs(fs), REG_EXTENDED);
-  return &TT.rx_last;
+  // A single-char FS is never a regex, even if it is a regex metachar.
+  // If regex FS is needed, must use > 1 char. If a '.' regex
+  // is needed, use e.g. '.|.' (unlikely case).
+  if (!fs[1]) return TT.fs_mode = FS_BYTE;
+  if (fs_class_prep(fs)) return TT.fs_mode = FS_CLASS;
+  TT.fs_mode = FS_LITERAL;
+  for (char *p = fs; *p; p++)
+    if (strchr("\\^$.[]|()*+?{}", *p)) TT.fs_mode = FS_REGEX;
+  return TT.fs_mode;
+}
+
+// Find FS in s, like rx_find_FS(); fs_mode is from fs_prep(), or
+// FS_REGEX to search for rx.
+static int fs_find(int fs_mode, regex_t *rx, char *s, size_t len,
+    size_t *start, size_t *end, int eflags)
+{
+  char *p = s, *lim = s + len;
+  switch (fs_mode) {
+    case FS_SPACE:    // Same as regex "[ \t\n]+"
+      while (p < lim && *p != ' ' && *p != '\t' && *p != '\n') p++;
+      if (p == lim) return REG_NOMATCH;
+      *start = p - s;
+      while (p < lim && (*p == ' ' || *p == '\t' || *p == '\n')) p++;
+      break;
+    case FS_BYTE:
+      if (!(p = memchr(s, TT.fs_last[0], len))) return REG_NOMATCH;
+      *start = p++ - s;
+      break;
+    case FS_LITERAL:
+      if (!(p = mem_find(s, len, TT.fs_last, strlen(TT.fs_last))))
+        return REG_NOMATCH;
+      *start = p - s;
+      p += strlen(TT.fs_last);
+      break;
+    case FS_CLASS:
+      while (p < lim && !TT.fs_set[(unsigned char)*p]) p++;
+      if (p == lim) return REG_NOMATCH;
+      *start = p++ - s;
+      if (TT.fs_run) while (p < lim && TT.fs_set[(unsigned char)*p]) p++;
+      break;
+    default:
+      return rx_find_FS(rx, s, len, start, end, eflags);
+  }
+  *end = p - s;
+  return 0;
 }
 
-// Only for use by split() builtin
+// Only for use by split() builtin. Elements left in m by the last split()
+// are updated in place, with no new keys or hashing; see tksplit.
 static void set_map_element(struct zmap *m, int k, char *val, size_t len)
 {
-  // Do not need format here b/c k is integer, uses "%lld" format.
-  struct zstring *key = num_to_zstring(k, "");// "" vs 0 format avoids warning
-  struct zmap_slot *zs = zmap_find_or_insert_key(m, key);
-  zstring_release(&key);
-  zs->val.vst = zstring_update(zs->val.vst, 0, val, len);
-  zs->val.flags = ZF_STR;
-  check_numeric_string(&zs->val);
+  struct zvalue *v;
+  if (k <= m->split_cnt) v = &MAPSLOT[k - 1].val;
+  else {
+    // Do not need format here b/c k is integer, uses "%lld" format.
+    struct zstring *key = num_to_zstring(k, "");// "" vs 0 format avoids warning
+    v = &zmap_find_or_insert_key(m, key)->val;
+    zstring_release(&key);
+  }
+  v->vst = zstring_update(v->vst, 0, val, len);
+  v->flags = ZF_STR;
+  check_numeric_string(v);
 }
 
 static void set_zvalue_str(struct zvalue *v, char *s, size_t size)
@@ -2706,14 +3730,13 @@ static void set_zvalue_str(struct zvalue *v, char *s, size_t size)
 // All changes to NF go through here!
 static void set_nf(int nf)
 {
-  if (nf < 0) FATAL("NF set negative");
   STACK[NF].num = TT.nf_internal = nf;
   STACK[NF].flags = ZF_NUM;
 }
 
 static void set_field(struct zmap *unused, int fnum, char *s, size_t size)
 { (void)unused;
-  if (fnum < 0 || fnum > FIELDS_MAX) FFATAL("bad field num %d\n", fnum);
+  if (fnum >= THIS_MEANS_SET_NF) FATAL("too many fields");
   int nfields = zlist_len(&TT.fields);
   // Need nfields to be > fnum b/c e.g. fnum==1 implies 2 TT.fields
   while (nfields <= fnum)
@@ -2723,16 +3746,157 @@ static void set_field(struct zmap *unused, int fnum, char *s, size_t size)
   check_numeric_string(&FIELD[fnum]);
 }
 
-// Split s via fs, using setter; return number of TT.fields.
-// This is used to split TT.fields and also for split() builtin.
-static int splitter(void (*setter)(struct zmap *, int, char *, size_t), struct zmap *m, char *s, struct zvalue *zvfs)
+// Split s (len bytes) as a CSV record (RFC 4180), for --csv: fields are
+// separated by commas, and a field in double quotes may hold commas,
+// newlines and doubled quotes (standing for one); the quotes are removed.
+// Resumable like splitter(), which calls this.
+static int csv_split(void (*setter)(struct zmap *, int, char *, size_t), struct zmap *m, char *s0, size_t len, struct split_state *st, int maxnf)
 {
-  regex_t *rx;
-  regoff_t offs, end;
-  int multiline_null_rs = !ENSURE_STR(&STACK[RS])->vst->str[0];
-  int nf = 0, r = 0, eflag = 0;
+  char *s = s0 + st->offs, *lim = s0 + len, *e;
+  int nf = st->nf;
+  st->pending = len != 0;
+  while (st->pending && nf < maxnf) {
+    if (s == lim || *s != '"') {
+      if (!(e = memchr(s, ',', lim - s))) e = lim;
+      setter(m, ++nf, s, e - s);
+    } else {
+      // Quoted field. Its value is a plain slice of s unless it has
+      // doubled quotes or text after the closing quote; then it is
+      // copied, without the extra quotes, to a temporary buffer.
+      char *q = s + 1, *buf = 0, *b = 0;
+      for (e = q; e < lim; ) {
+        char *c = memchr(e, '"', lim - e);
+        if (!c || c + 1 == lim || c[1] != '"') {
+          e = c ? c : lim;
+          break;
+        }
+        if (!buf) b = buf = xmalloc(lim - s);
+        memcpy(b, q, c + 1 - q);
+        b += c + 1 - q;
+        e = q = c + 2;
+      }
+      char *after = e < lim ? e + 1 : lim;   // past closing quote
+      char *comma = memchr(after, ',', lim - after);
+      if (!comma) comma = lim;
+      if (comma > after && !buf) b = buf = xmalloc(lim - s);
+      if (buf) {
+        memcpy(b, q, e - q);
+        b += e - q;
+        memcpy(b, after, comma - after);
+        b += comma - after;
+        setter(m, ++nf, buf, b - buf);
+        xfree(buf);
+      } else setter(m, ++nf, q, e - q);
+      e = comma;
+    }
+    s = e + 1;
+    st->pending = e < lim;
+  }
+  st->offs = s - s0;
+  return st->nf = nf;
+}
+
+// Set up TT.fieldwidths for the current FIELDWIDTHS, a list of field widths
+// in characters, each optionally prefixed with "skip:" to skip that many
+// characters first; the last may be "*" for the rest of the record.
+// Return nonzero if fields are to be split by FIELDWIDTHS (it is not "").
+static int fw_prep(void)
+{
+  struct zstring *fw = ENSURE_STR(&STACK[FIELDWIDTHS])->vst;
+  if (fw == TT.fw_last || (TT.fw_last && zstring_match(fw, TT.fw_last)))
+    return zlist_len(&TT.fieldwidths);
+  zstring_release(&TT.fw_last);
+  zstring_incr_refcnt(TT.fw_last = fw);
+  if (!TT.fieldwidths.base) zlist_init(&TT.fieldwidths, sizeof(int));
+  TT.fieldwidths.avail = TT.fieldwidths.base;
+  char *s = fw->str;
+  int col = 0, star = 0;
+  while (*(s += strspn(s, " \t\n"))) {
+    if (star) FFATAL("'*' must be last in FIELDWIDTHS: '%s'\n", fw->str);
+    long skip = 0, n = -1;
+    if (isdigit(*s)) {
+      n = strtol(s, &s, 10);
+      if (*s == ':') {
+        skip = n;
+        n = isdigit(*++s) ? strtol(s, &s, 10) : -1;
+      }
+    }
+    if (n < 0 && *s == '*') s++, star = 1;
+    if ((n < 0 && !star) || (*s && !strchr(" \t\n", *s))
+        || col + skip + maxof(n, 0) > INT_MAX / 2)
+      FFATAL("bad FIELDWIDTHS: '%s'\n", fw->str);
+    int k = col + skip;
+    zlist_append(&TT.fieldwidths, &k);
+    k = n;
+    zlist_append(&TT.fieldwidths, &k);
+    col += skip + maxof(n, 0);
+  }
+  return zlist_len(&TT.fieldwidths);
+}
+
+// Return 1 if s (len bytes) is all ASCII. No early exit, so it vectorizes.
+static int all_ascii(char *s, size_t len)
+{
+  unsigned long long w, acc = 0;
+  size_t k = 0;
+  for (; k + 8 <= len; k += 8) {
+    memcpy(&w, s + k, 8);
+    acc |= w;
+  }
+  for (; k < len; k++) acc |= (unsigned char)s[k];
+  return !(acc & 0x8080808080808080ULL);
+}
+
+// Bytes in cols columns at s, for fw_split()
+static size_t fw_bytes(struct split_state *st, char *s, size_t len,
+    size_t cols)
+{
+  return st->ascii ? cols : bytesinutf8(s, len, cols);
+}
+
+// Split s (len bytes) into fields at the columns set by FIELDWIDTHS (see
+// fw_prep()); fields past the end of the record are not set. The record
+// is checked once for non-ASCII bytes; if there are none (or with -b), a
+// field's byte offset is its column, else the columns before it are
+// counted as UTF-8. Resumable like splitter(), which calls this; st->r is
+// the column at st->offs.
+static int fw_split(void (*setter)(struct zmap *, int, char *, size_t), struct zmap *m, char *s0, size_t len, struct split_state *st, int maxnf)
+{
+  int *fw = (int *)TT.fieldwidths.base, nfw = zlist_len(&TT.fieldwidths) / 2;
+  size_t offs = st->offs, col = st->r;
+  int nf = st->nf;
+  if (!nf && !offs) st->ascii = FLAG(b) || all_ascii(s0, len);
+  while (nf < nfw && nf < maxnf && offs < len) {
+    size_t start = fw[2 * nf], width = fw[2 * nf + 1];
+    offs += fw_bytes(st, s0 + offs, len - offs, start - col);
+    if (offs >= len) break;
+    size_t flen = width == (size_t)-1 ? len - offs
+        : minof(fw_bytes(st, s0 + offs, len - offs, width), len - offs);
+    setter(m, ++nf, s0 + offs, flen);
+    offs += flen;
+    col = start + (width == (size_t)-1 ? 0 : width);
+  }
+  st->offs = minof(offs, len);
+  st->r = col;
+  st->pending = nf < nfw && offs < len;
+  return st->nf = nf;
+}
+
+// Split s (len bytes) via fs, using setter; return number of TT.fields.
+// This is used to split TT.fields and also for split() builtin.
+// s need not be null-terminated if REG_STARTEND is available.
+// Splitting starts, and stops once field maxnf is set, per *st, so it can
+// be resumed later; st->pending is cleared when s is all split.
+static int splitter(void (*setter)(struct zmap *, int, char *, size_t), struct zmap *m, char *s, size_t len, struct zvalue *zvfs, struct split_state *st, int maxnf)
+{
+  regex_t *rx = 0;
+  size_t offs, end;
+  int nf = st->nf, r = st->r, fs_mode = FS_REGEX;
   int one_char_fs = 0;
-  char *s0 = s, *fs = "";
+  char *s0 = s, *lim = s + len, *fs = "";
+  if (st->csv) return csv_split(setter, m, s, len, st, maxnf);
+  if (st->fw) return fw_split(setter, m, s, len, st, maxnf);
+  s += st->offs;
   if (!IS_RX(zvfs)) {
     to_str(zvfs);
     fs = zvfs->vst->str;
@@ -2741,79 +3905,135 @@ static int splitter(void (*setter)(struct zmap *, int, char *, size_t), struct z
   // Empty string or empty fs (regex).
   // Need to include !*s b/c empty string, otherwise
   // split("", a, "x") splits to a 1-element (empty element) array
-  if (!*s || (IS_STR(zvfs) && !*fs) || IS_EMPTY_RX(zvfs)) {
-    while (*s) {
+  if (!len || (IS_STR(zvfs) && !*fs) || IS_EMPTY_RX(zvfs)) {
+    while (s < lim && nf < maxnf) {
       if (*s < 128) setter(m, ++nf, s++, 1);
       else {        // Handle UTF-8
         char cbuf[8];
         unsigned wc;
-        int nc = utf8towc(&wc, s, strlen(s));
-        if (nc < 2) FFATAL("bad string for split: \"%s\"\n", s0);
+        int nc = utf8towc(&wc, s, lim - s);
+        if (nc < 2) FFATAL("bad string for split: \"%.*s\"\n", (int)len, s0);
         s += nc;
         nc = wctoutf8(cbuf, wc);
         setter(m, ++nf, cbuf, nc);
       }
     }
-    return nf;
+    st->pending = s < lim;
+    st->offs = s - s0;
+    return st->nf = nf;
   }
-  if (IS_RX(zvfs)) rx = zvfs->rx;
-  else rx = rx_fs_prep(fs);
-  while (*s) {
+  if (IS_RX(zvfs)) rx = &zvfs->rx->rx;
+  else if ((fs_mode = fs_prep(fs)) == FS_REGEX)
+    rx = &rx_cached(zvfs->vst, 0)->rx;
+  while (s < lim && nf < maxnf) {
     // Find the next occurrence of FS.
     // rx_find_FS() returns 0 if found. If nonzero, the field will
     // be the rest of the record (all of it if first time through).
-    if ((r = rx_find_FS(rx, s, &offs, &end, eflag))) offs = end = strlen(s);
-    if (setter == set_field && multiline_null_rs && one_char_fs) {
+    if ((r = fs_find(fs_mode, rx, s, lim - s, &offs, &end, st->eflag)))
+      offs = end = lim - s;
+    if (st->nl_fs && one_char_fs) {
       // Contra POSIX, if RS=="" then newline is always also a
       // field separator only if FS is a single char (see gawk manual)
-      int k = strcspn(s, "\n");
-      if (k < offs) offs = k, end = k + 1;
+      char *nl = memchr(s, '\n', offs);
+      if (nl) offs = nl - s, end = offs + 1;
     }
-    eflag |= REG_NOTBOL;
+    st->eflag |= REG_NOTBOL;
 
     // Field will be s up to (not including) the offset. If offset
-    // is zero and FS is found and FS is ' ' (TT.rx_default "[ \t]+"),
+    // is zero and FS is found and FS is ' ' (FS_SPACE, "[ \t\n]+"),
     // then the find is the leading or trailing spaces and/or tabs.
     // If so, skip this (empty) field, otherwise set field, length is offs.
-    if (offs || r || rx != &TT.rx_default) setter(m, ++nf, s, offs);
+    if (offs || r || fs_mode != FS_SPACE) setter(m, ++nf, s, offs);
     s += end;
   }
-  if (!r && rx != &TT.rx_default) setter(m, ++nf, "", 0);
-  return nf;
+  st->r = r;
+  st->offs = s - s0;
+  if ((st->pending = s < lim)) return st->nf = nf;
+  if (!r && fs_mode != FS_SPACE) setter(m, ++nf, "", 0);
+  return st->nf = nf;
+}
+
+static void rebuild_field0(void);
+
+// A record read as $0 is normally left in its input buffer (TT.rgl.rec0)
+// and copied to FIELD[0] only when $0 is referenced as a value, or before
+// the buffer is changed or freed. zfp is the file whose buffer will change,
+// or NULL to make FIELD[0] hold $0 regardless (rebuilding it if a field or
+// NF was assigned since; see fixup_fields()).
+static void own_field0(struct zfile *zfp)
+{
+  if (!zfp && TT.rgl.field0_stale) rebuild_field0();
+  if (!TT.rgl.rec0 || (zfp && zfp != TT.rgl.rec0_zfp)) return;
+  set_zvalue_str(&FIELD[0], TT.rgl.rec0, TT.rgl.rec0len);
+  check_numeric_string(&FIELD[0]);
+  TT.rgl.rec0 = 0;
+}
+
+// Split $0 (from its input buffer, or FIELD[0]) into fields through field
+// fnum (all of them for THIS_MEANS_SET_NF), going on from where the last
+// split stopped.
+static void split_fields(int fnum)
+{
+  if (!TT.rgl.split.pending || fnum <= TT.rgl.split.nf) return;
+  char *rec = TT.rgl.rec0 ? TT.rgl.rec0 : FIELD[0].vst->str;
+  size_t len = TT.rgl.rec0 ? TT.rgl.rec0len : FIELD[0].vst->size;
+  struct zvalue fs = ZVINIT(ZF_STR, 0, TT.rgl.split_fs);
+  // A program with $expr likely wants most fields; else get those it names
+  if (TT.field_dyn) fnum = THIS_MEANS_SET_NF;
+  else if (fnum < TT.field_max) fnum = TT.field_max;
+  set_nf(splitter(set_field, 0, rec, len, &fs, &TT.rgl.split, fnum));
 }
 
+// A new $0 is split into fields only as far as the program looks: when a
+// field is referenced, or all of it if NF is (or a field is assigned, which
+// rebuilds $0). FS and RS are those in effect now, as POSIX requires.
 static void build_fields(void)
 {
-  char *rec = FIELD[0].vst->str;
+  size_t len = TT.rgl.rec0 ? TT.rgl.rec0len : FIELD[0].vst->size;
+  struct zstring *fs = to_str(&STACK[FS])->vst;
+  zstring_incr_refcnt(fs);
+  zstring_release(&TT.rgl.split_fs);
+  TT.rgl.split_fs = fs;
+  TT.rgl.split = (struct split_state){0};
+  TT.rgl.split.nl_fs = !ENSURE_STR(&STACK[RS])->vst->str[0];
+  TT.rgl.split.csv = FLAG(csv);
+  TT.rgl.split.fw = TT.fw_mode && !FLAG(csv) && fw_prep();
   // TODO test this -- why did I not want to split empty $0?
   // Maybe don't split empty $0 b/c non-default FS gets NF==1 with splitter()?
-  set_nf(*rec ? splitter(set_field, 0, rec, to_str(&STACK[FS])) : 0);
+  TT.rgl.split.pending = len != 0;
+  set_nf(0);
+  if (TT.nf_ref) split_fields(THIS_MEANS_SET_NF);
 }
 
+// Join the fields with OFS (see set_field0_stale()) into a new $0, in one
+// allocation (or none if the old $0 is unshared and big enough).
 static void rebuild_field0(void)
 {
-  struct zstring *s = FIELD[0].vst;
+  TT.rgl.rec0 = 0;    // $0 will be rebuilt from fields
+  TT.rgl.field0_stale = 0;
   int nf = TT.nf_internal;
   if (!nf) {
     zvalue_copy(&FIELD[0], &uninit_string_zvalue);
     return;
   }
-  // uninit value needed for eventual reference to .vst in zstring_release()
-  struct zvalue tempv = uninit_zvalue;
-  zvalue_copy(&tempv, to_str(&STACK[OFS]));
+  struct zstring *ofs = TT.rgl.rebuild_ofs, *s = FIELD[0].vst;
+  size_t len = (nf - 1) * ofs->size;
   for (int i = 1; i <= nf; i++) {
-    if (i > 1) {
-      s = s ? zstring_extend(s, tempv.vst) : zstring_copy(s, tempv.vst);
-    }
-    if (FIELD[i].flags) to_str(&FIELD[i]);
+    if (FIELD[i].flags && !IS_STR(&FIELD[i])) to_str(&FIELD[i]);
+    if (FIELD[i].vst) len += FIELD[i].vst->size;
+  }
+  if (s && s->refcnt) zstring_release(&s);
+  s = zstring_update(s, len, "", 0);
+  char *p = s->str;
+  for (int i = 1; i <= nf; i++) {
+    if (i > 1) memcpy(p, ofs->str, ofs->size), p += ofs->size;
     if (FIELD[i].vst) {
-      if (i > 1) s = zstring_extend(s, FIELD[i].vst);
-      else s = zstring_copy(s, FIELD[i].vst);
+      memcpy(p, FIELD[i].vst->str, FIELD[i].vst->size);
+      p += FIELD[i].vst->size;
     }
   }
   FIELD[0].vst = s;
   FIELD[0].flags |= ZF_STR;
-  zvalue_release_zstring(&tempv);
 }
 
 // get field ref (lvalue ref) in prep for assignment to field.
@@ -2824,7 +4044,8 @@ static void rebuild_field0(void)
 // Called by setup_lvalue()
 static struct zvalue *get_field_ref(int fnum)
 {
-  if (fnum < 0 || fnum > FIELDS_MAX) error_exit("bad field num %d", fnum);
+  if (!fnum) own_field0(0);
+  else split_fields(THIS_MEANS_SET_NF);   // $0 will be rebuilt
   if (fnum > TT.nf_internal) {
     // Ensure TT.fields list is large enough for fnum
     // Need len of TT.fields to be > fnum b/c e.g. fnum==1 implies 2 TT.fields
@@ -2837,22 +4058,48 @@ static struct zvalue *get_field_ref(int fnum)
   return &FIELD[fnum];
 }
 
-// Called by tksplit op
-static int split(struct zstring *s, struct zvalue *a, struct zvalue *fs)
+// Called by tksplit op; csv is set to split as CSV (see csv_split())
+static int split(struct zstring *s, struct zvalue *a, struct zvalue *fs, int csv)
 {
-  return splitter(set_map_element, a->map, s->str, fs);
+  struct split_state st = {0};
+  st.csv = csv;
+  return splitter(set_map_element, a->map, s->str, s->size, fs, &st, INT_MAX);
 }
 
 // Called by getrec_f0_f() and getrec_f0()
-static void copy_to_field0(char *buf, size_t k)
-{
-  set_zvalue_str(&FIELD[0], buf, k);
-  check_numeric_string(&FIELD[0]);
+// Record is k bytes at buf, in the input buffer of zfp. The fields are
+// split from there; $0 borrows it until own_field0(). Without
+// REG_STARTEND the regex code needs a null-terminated copy right away.
+static void set_field0(struct zfile *zfp, char *buf, size_t k)
+{
+  if (REG_STARTEND) {
+    TT.rgl.rec0 = buf;
+    TT.rgl.rec0len = k;
+    TT.rgl.rec0_zfp = zfp;
+  } else {
+    set_zvalue_str(&FIELD[0], buf, k);
+    check_numeric_string(&FIELD[0]);
+  }
+  TT.rgl.field0_stale = 0;
   build_fields();
 }
 
+// $0 no longer matches the fields. It will be rebuilt with the OFS in
+// effect now, as it would have been right away.
+static void set_field0_stale(void)
+{
+  struct zstring *ofs = to_str(&STACK[OFS])->vst;
+  zstring_incr_refcnt(ofs);
+  zstring_release(&TT.rgl.rebuild_ofs);
+  TT.rgl.rebuild_ofs = ofs;
+  TT.rgl.rec0 = 0;
+  TT.rgl.field0_stale = 1;
+}
+
 // After changing $0, must rebuild TT.fields & reset NF
-// Changing other field must rebuild $0
+// Changing other field (or NF) must rebuild $0; that is put off until $0
+// is next used (see own_field0()), so several field assignments cost one
+// rebuild.
 // Called by gsub() and assignment ops.
 static void fixup_fields(int fnum)
 {
@@ -2865,15 +4112,18 @@ static void fixup_fields(int fnum)
       zvalue_copy(&FIELD[i], &uninit_string_zvalue);
     }
     set_nf(TT.nf_internal = STACK[NF].num);
-    rebuild_field0();
+    set_field0_stale();
     return;
   }
   // fnum is # of field that was just updated.
   // If it's 0, need to rebuild the TT.fields 1... n.
   // If it's non-0, need to rebuild field 0.
+  // A field set to a number or numeric string stays one after it is
+  // made a string (with CONVFMT) for rebuilding $0.
+  unsigned was_num = FIELD[fnum].flags & (ZF_NUM | ZF_NUMCHK);
   to_str(&FIELD[fnum]);
-  if (fnum) check_numeric_string(&FIELD[fnum]);
-  if (fnum) rebuild_field0();
+  if (fnum && was_num) check_numeric_string(&FIELD[fnum]);
+  if (fnum) set_field0_stale();
   else build_fields();
 }
 
@@ -2881,10 +4131,13 @@ static void fixup_fields(int fnum)
 // Called by tkfield op       // TODO inline it?
 static void push_field(int fnum)
 {
-  if (fnum < 0 || fnum > FIELDS_MAX) error_exit("bad field num %d", fnum);
   // Contrary to posix, awk evaluates TT.fields beyond $NF as empty strings.
+  split_fields(fnum);
   if (fnum > TT.nf_internal) push_val(&uninit_string_zvalue);
-  else push_val(&FIELD[fnum]);
+  else {
+    if (!fnum) own_field0(0);
+    push_val(&FIELD[fnum]);
+  }
 }
 
 ////////////////////
@@ -2930,6 +4183,7 @@ static int get_set_logical(void)
   struct zvalue *v = STKP;
   force_maybemap_to_scalar(v);
   int r = 0;
+  numstr_check(v);
   if (IS_NUM(v)) r = !! v->num;
   else if (IS_STR(v)) r = (v->vst && v->vst->str[0]);
   zvalue_release_zstring(v);
@@ -2944,8 +4198,9 @@ static double to_num(struct zvalue *v)
   force_maybemap_to_scalar(v);
   if (v->flags & ZF_NUMSTR) zvalue_release_zstring(v);
   else if (!IS_NUM(v)) {
+    char *s;
     v->num = 0.0;
-    if (IS_STR(v) && v->vst) v->num = atof(v->vst->str);
+    if (IS_STR(v) && v->vst) v->num = str_to_num(v->vst->str, &s);
     zvalue_release_zstring(v);
   }
   v->flags = ZF_NUM;
@@ -2972,6 +4227,21 @@ static void push_int_val(ptrdiff_t n)
 
 static struct zvalue *get_map_val(struct zvalue *v, struct zvalue *key)
 {
+  if (key->flags == ZF_NUM) {
+    // Look up a number without making a zstring unless it's a new key
+    union {
+      struct zstring z;
+      char b[sizeof(struct zstring) + PBUFSIZE];
+    } k;
+    k.z.refcnt = 0;
+    k.z.capacity = PBUFSIZE;
+    k.z.size = num_to_buf(k.z.str, key->num, fmt_str(CONVFMT));
+    struct zvalue *x = zmap_find(v->map, &k.z);
+    if (x) return x;
+    zvalue_release_zstring(key);
+    key->vst = new_zstring(k.z.str, k.z.size);
+    key->flags = ZF_STR;
+  }
   struct zmap_slot *x = zmap_find_or_insert_key(v->map, to_str(key)->vst);
   return &x->val;
 }
@@ -2991,9 +4261,12 @@ static struct zvalue *setup_lvalue(int ref_stack_ptr, int parmbase, int *field_n
   struct zvalue *ref, *v = 0; // init v to mute "may be uninit" warning
   *field_num = -1;
   ref = STKP - ref_stack_ptr;
-  if (ref->flags & ZF_FIELDREF) return get_field_ref(*field_num = ref->num);
+  if (ref->flags & ZF_FIELDREF)
+    return get_field_ref(*field_num = to_field_num(ref->num));
   k = ref->num >= 0 ? ref->num : parmbase - ref->num;
   if (k == NF) *field_num = THIS_MEANS_SET_NF;
+  // As in gawk, whichever of FS and FIELDWIDTHS was set last is used
+  if (k == FS || k == FIELDWIDTHS) TT.fw_mode = k == FIELDWIDTHS;
   v = &STACK[k];
   if (ref->flags & ZF_REF) {
     force_maybemap_to_scalar(v);
@@ -3007,23 +4280,200 @@ static struct zvalue *setup_lvalue(int ref_stack_ptr, int parmbase, int *field_n
   return v; // order FATAL() and return to mute warning
 }
 
-static struct zfile *new_file(char *fn, FILE *fp, char mode, char file_or_pipe,
-                              char is_std_file)
+static struct zfile *new_file(char *fn, int slot, FILE *fp, char mode,
+                              char file_or_pipe, char is_std_file)
 {
   struct zfile *f = xzalloc(sizeof(struct zfile));
   *f = (struct zfile){TT.zfiles, xstrdup(fn), fp, mode, file_or_pipe,
-                isatty(fileno(fp)), is_std_file, 0, 0, 0, 0, 0};
-  return TT.zfiles = f;
+                isatty(fileno(fp)), is_std_file, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                slot, 0, 0};
+  return FILESLOT[slot].zfp = TT.zfiles = f;
+}
+
+static void new_std_file(char *fn, FILE *fp, char mode)
+{
+  struct zstring *name = new_zstring(fn, strlen(fn));
+  new_file(fn, file_slot(name), fp, mode, 1, 1);
+  zstring_release(&name);
+}
+
+// Open file (if any) for a redirection name
+static struct zfile *find_file(struct zstring *name)
+{
+  struct zvalue *v = TT.file_map ? zmap_find(TT.file_map, name) : 0;
+  return v ? FILESLOT[(int)v->num].zfp : 0;
+}
+
+#define READ_AHEAD  (1 << 20)  // input bytes the OS is asked to read ahead
+#define READ_BUF_MIN  65536   // initial input buffer size, exc. tty
+
+// Ask the OS to start reading the next part of a mapped file, so the i/o
+// overlaps with processing of the part before it.
+static void read_ahead(struct zfile *zfp)
+{
+#ifndef NO_MMAP
+  while (zfp->ahead < zfp->lim && zfp->ahead < zfp->ro + READ_AHEAD) {
+    size_t n = minof(READ_AHEAD, zfp->lim - zfp->ahead);
+    posix_madvise(zfp->buf + zfp->ahead, n, POSIX_MADV_WILLNEED);
+    zfp->ahead += n;
+  }
+#else
+  (void)zfp;
+#endif  // NO_MMAP
+}
+
+#ifndef NO_MMAP
+// Touching a page of a mapped file past the file's end raises SIGBUS,
+// which happens if the file is truncated while it is read (log rotation
+// by copytruncate, say). The handler maps zero pages from there to the
+// end of the mapping, so the access goes on, and notes the place;
+// getr() then ends the file there, as read() would.
+static char *map_cut;
+static long map_pagesize;
+static int map_zero_fd = -1;
+
+static int map_sigbus_zero(struct zfile *zfp, char *a)
+{
+  if (!zfp->is_mapped || a < zfp->buf || a >= zfp->buf + zfp->buflen)
+    return 0;
+  char *p = a - (a - zfp->buf) % map_pagesize;
+  if (mmap(p, zfp->buf + zfp->buflen - p, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+        map_zero_fd, 0) == MAP_FAILED) return 0;
+  if (!map_cut || p < map_cut) map_cut = p;
+  return 1;
+}
+
+static void map_sigbus(int sig, siginfo_t *si, void *uc)
+{
+  (void)uc;
+  if (map_sigbus_zero(TT.cfile, si->si_addr)) return;
+  for (struct zfile *zfp = TT.zfiles; zfp; zfp = zfp->next)
+    if (map_sigbus_zero(zfp, si->si_addr)) return;
+  signal(sig, SIG_DFL);   // not in a mapped file; fault again and die
+}
+
+// If zfp was cut short (see map_sigbus()), end it there, or where the
+// file now ends if that is sooner; return 1 if so.
+static int map_end_at_cut(struct zfile *zfp)
+{
+  struct stat st;
+  size_t end;
+  if (!zfp->is_mapped || map_cut < zfp->buf
+      || map_cut >= zfp->buf + zfp->buflen) return 0;
+  end = map_cut - zfp->buf;
+  if (!fstat(fileno(zfp->fp), &st) && (size_t)st.st_size < end)
+    end = st.st_size;
+  zfp->lim = maxof(zfp->ro, end);
+  map_cut = 0;
+  return 1;
+}
+#endif  // NO_MMAP
+
+// Map a regular input file into memory in place of the read buffer.
+// Leaves zfp unchanged (so getr() uses read()) if the file can't be mapped.
+static void map_file(struct zfile *zfp)
+{
+#ifndef NO_MMAP
+  struct stat st;
+  off_t pos = lseek(fileno(zfp->fp), 0, SEEK_CUR);
+  char *p;
+  if (zfp->is_tty || pos < 0 || fstat(fileno(zfp->fp), &st)
+      || !S_ISREG(st.st_mode) || st.st_size <= pos
+      || (off_t)(size_t)st.st_size != st.st_size)   // too big for 32 bits
+    return;
+  // Without REG_STARTEND, a regex RS needs a NUL after the data; mapped
+  // bytes past EOF in the last page are zero, so a full last page won't do.
+  if (!REG_STARTEND && !(st.st_size % sysconf(_SC_PAGESIZE))) return;
+  if (map_zero_fd < 0) {
+    struct sigaction sa = {0};
+    if ((map_zero_fd = open("/dev/zero", O_RDONLY | O_CLOEXEC)) < 0) return;
+    map_pagesize = sysconf(_SC_PAGESIZE);
+    sa.sa_sigaction = map_sigbus;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGBUS, &sa, 0);
+  }
+  p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fileno(zfp->fp), 0);
+  if (p == MAP_FAILED) return;
+  posix_madvise(p, st.st_size, POSIX_MADV_SEQUENTIAL);
+  zfp->buf = p;
+  zfp->buflen = zfp->lim = st.st_size;
+  zfp->ro = pos;
+  zfp->ahead = pos - pos % READ_AHEAD;  // page aligned
+  zfp->eof = zfp->is_mapped = 1;
+  read_ahead(zfp);
+#else
+  (void)zfp;
+#endif  // NO_MMAP
+}
+
+static void free_file_buf(struct zfile *zfp)
+{
+  own_field0(zfp);
+#ifndef NO_MMAP
+  if (zfp->is_mapped) munmap(zfp->buf, zfp->buflen);
+  else
+#endif  // NO_MMAP
+    xfree(zfp->buf);
+}
+
+#define OUTBUF_SIZE  65536   // output buffer size per output file/pipe
+
+// print and printf output is buffered here and written with write(), not
+// stdio, so each print is just a few memcpy()s of known-length strings.
+static int write_all(struct zfile *zfp, char *s, size_t n)
+{
+  while (n) {
+    ssize_t k = write(fileno(zfp->fp), s, n);
+    if (k < 0 && errno == EINTR) continue;
+    if (k <= 0) return -1;
+    s += k;
+    n -= k;
+  }
+  return 0;
+}
+
+static int flush_out(struct zfile *zfp)
+{
+  int r = write_all(zfp, zfp->obuf, zfp->olen);
+  zfp->olen = 0;
+  return r;
+}
+
+static void out_write(struct zfile *zfp, char *s, size_t n)
+{
+  if (zfp->mode == 'r') return;   // open for getline; can't print to it
+  if (zfp->olen + n > OUTBUF_SIZE) {
+    flush_out(zfp);
+    if (n >= OUTBUF_SIZE) {
+      write_all(zfp, s, n);
+      return;
+    }
+  }
+  if (!zfp->obuf) zfp->obuf = xmalloc(OUTBUF_SIZE);
+  memcpy(zfp->obuf + zfp->olen, s, n);
+  zfp->olen += n;
+}
+
+// Input is read with read() on the fd, so leave input streams alone.
+static int fflush_one(struct zfile *zfp)
+{
+  if (zfp->mode == 'r') return 0;
+  return flush_out(zfp) | (zfp->fp ? fflush(zfp->fp) : 0);  // if not parked
 }
 
 static int fflush_all(void)
 {
   int ret = 0;
   for (struct zfile *p = TT.zfiles; p; p = p->next)
-    if (fflush(p->fp)) ret = -1;
+    if (fflush_one(p)) ret = -1;
   return ret;
 }
 
+static void flush_at_exit(void)
+{
+  fflush_all();
+}
+
 static int fflush_file(int nargs)
 {
   if (!nargs) return fflush_all();
@@ -3033,29 +4483,86 @@ static int fflush_file(int nargs)
   if (!STKP[0].vst->str[0]) return fflush_all();
 
   // is it open in file table?
-  for (struct zfile *p = TT.zfiles; p; p = p->next)
-    if (!strcmp(STKP[0].vst->str, p->fn))
-      if (!fflush(p->fp)) return 0;
-  return -1;    // error, or file not found in table
+  struct zfile *p = find_file(STKP[0].vst);
+  return p ? fflush_one(p) : -1;  // error, or file not found in table
+}
+
+
+// Output files are also kept on a list, most recently used first. When
+// too many files are open, the least recently used one is closed
+// ("parked"), and is reopened to append when it is used again. Pipes can't
+// be reopened, and files open for getline would lose their place, so only
+// output files are parked.
+static struct zfile lru_obj = {.lru_prev = &lru_obj, .lru_next = &lru_obj};
+static struct zfile *lru = &lru_obj;
+
+static void lru_unlink(struct zfile *zfp)
+{
+  if (!zfp->lru_next) return;
+  zfp->lru_prev->lru_next = zfp->lru_next;
+  zfp->lru_next->lru_prev = zfp->lru_prev;
+  zfp->lru_prev = zfp->lru_next = 0;
+  TT.lru_cnt--;
 }
-static int close_file(char *fn)
+
+static void lru_use(struct zfile *zfp)
+{
+  if (zfp->lru_prev == lru) return;   // already most recent
+  lru_unlink(zfp);
+  zfp->lru_prev = lru;
+  zfp->lru_next = lru->lru_next;
+  lru->lru_next->lru_prev = zfp;
+  lru->lru_next = zfp;
+  TT.lru_cnt++;
+}
+
+// Close the least recently used output file; return 0 if there is none.
+static int park_file(void)
+{
+  struct zfile *zfp = lru->lru_prev;
+  if (zfp == lru) return 0;
+  lru_unlink(zfp);
+  flush_out(zfp);
+  xfree(zfp->obuf);
+  zfp->obuf = 0;
+  fclose(zfp->fp);
+  zfp->fp = 0;
+  return 1;
+}
+
+// fopen() or popen(), parking output files if out of file descriptors
+static FILE *open_file(char *fn, char file_or_pipe, char *mode)
+{
+  FILE *fp;
+  while (!(fp = (file_or_pipe ? fopen : popen)(fn, mode))
+      && (errno == EMFILE || errno == ENFILE) && park_file())
+    ;
+  return fp;
+}
+
+static int close_file(struct zstring *fn)
 {
   // !fn (null ptr) means close all (exc. stdin/stdout/stderr)
   int r = 0;
-  struct zfile *np, **pp = &TT.zfiles;
+  struct zfile *zfp = 0, *np, **pp = &TT.zfiles;
+  if (fn && !(zfp = find_file(fn))) return -1;  // file not in table
   for (struct zfile *p = TT.zfiles; p; p = np) {
     np = p->next;   // save in case unlinking file (invalidates p->next)
     // Don't close std files -- wrecks print/printf (can be fixed though TODO)
-    if ((!p->is_std_file) && (!fn || !strcmp(fn, p->fn))) {
-      xfree(p->buf);
+    if ((!p->is_std_file) && (!zfp || p == zfp)) {
+      lru_unlink(p);
+      flush_out(p);
+      xfree(p->obuf);
+      free_file_buf(p);
       xfree(p->fn);
-      r = (p->fp) ? (p->file_or_pipe ? fclose : pclose)(p->fp) : -1;
+      r = (p->fp) ? (p->file_or_pipe ? fclose : pclose)(p->fp) : 0;
+      FILESLOT[p->slot].zfp = 0;
       *pp = p->next;
       xfree(p);
       if (fn) return r;
     } else pp = &p->next; // only if not unlinking zfile
   }
-  return -1;  // file not in table, or closed all files
+  return -1;  // std file, or closed all files
 }
 
 static struct zfile badfile_obj, *badfile = &badfile_obj;
@@ -3063,25 +4570,34 @@ static struct zfile badfile_obj, *badfile = &badfile_obj;
 // FIXME TODO check if file/pipe/mode matches what's in the table already.
 // Apparently gawk/mawk/nawk are OK with different mode, but just use the file
 // in whatever mode it's already in; i.e. > after >> still appends.
-static struct zfile *setup_file(char file_or_pipe, char *mode)
+// slot is the file table slot if the name was a constant (see redir_target()
+// in compile.c), else -1 and the name is at top of TT.stack.
+static struct zfile *setup_file(char file_or_pipe, char *mode, int slot)
 {
-  to_str(STKP);   // filename at top of TT.stack
-  char *fn = STKP[0].vst->str;
-  // is it already open in file table?
-  for (struct zfile *p = TT.zfiles; p; p = p->next)
-    if (!strcmp(fn, p->fn)) {
-      drop();
-      return p;   // open; return it
-    }
-  FILE *fp = (file_or_pipe ? fopen : popen)(fn, mode);
-  if (fp) {
-    struct zfile *p = new_file(fn, fp, *mode, file_or_pipe, 0);
+  if (slot < 0) {
+    slot = file_slot(to_str(STKP)->vst);
     drop();
+  }
+  // is it already open in file table?
+  struct zfile *p = FILESLOT[slot].zfp;
+  if (p && p->fp) {
+    if (p->lru_next) lru_use(p);
     return p;
   }
-  if (*mode != 'r') FFATAL("cannot open '%s'\n", fn);
-  drop();
-  return badfile;
+  char *fn = FILESLOT[slot].name->str;
+  int is_output_file = p || (file_or_pipe && *mode != 'r');
+  if (p) {    // parked
+    if (!(p->fp = open_file(fn, 1, "a"))) FFATAL("cannot reopen '%s'\n", fn);
+  } else {
+    FILE *fp = open_file(fn, file_or_pipe, mode);
+    if (!fp) {
+      if (*mode != 'r') FFATAL("cannot open '%s'\n", fn);
+      return badfile;
+    }
+    p = new_file(fn, slot, fp, *mode, file_or_pipe, 0);
+  }
+  if (is_output_file) lru_use(p);
+  return p;
 }
 
 // TODO FIXME should be a function?
@@ -3093,62 +4609,215 @@ static int getcnt(int k)
   return (int)to_num(&STACK[k]);
 }
 
-static int fsprintf(FILE *ignored, const char *fmt, ...)
+// Make room for n more bytes (and a NUL) at the end of TT.rgl.zspr.
+// Unfortunately we have to mess with zstring internals here.
+static char *spr_room(size_t n)
+{
+  if (TT.rgl.zspr->size + n + 1 > TT.rgl.zspr->capacity) {
+    // This should always work b/c capacity > size
+    size_t cap = 2 * TT.rgl.zspr->capacity + n;
+    TT.rgl.zspr = xrealloc(TT.rgl.zspr, sizeof(*TT.rgl.zspr) + cap);
+    TT.rgl.zspr->capacity = cap;
+  }
+  return TT.rgl.zspr->str + TT.rgl.zspr->size;
+}
+
+static void spr_added(size_t n)
+{
+  TT.rgl.zspr->size += n;
+  TT.rgl.zspr->str[TT.rgl.zspr->size] = 0;
+}
+
+static void fsprintf(const char *fmt, ...)
 {
-  (void)ignored;
   va_list args, args2;
   va_start(args, fmt);
   va_copy(args2, args);
-  int len = vsnprintf(0, 0, fmt, args); // size needed
+  size_t room = TT.rgl.zspr->capacity - TT.rgl.zspr->size;
+  int len = vsnprintf(TT.rgl.zspr->str + TT.rgl.zspr->size, room, fmt, args);
   va_end(args);
-  if (len < 0) FATAL("Bad sprintf format");
-  // Unfortunately we have to mess with zstring internals here.
-  if (TT.rgl.zspr->size + len + 1 > TT.rgl.zspr->capacity) {
-      // This should always work b/c capacity > size
-      unsigned cap = 2 * TT.rgl.zspr->capacity + len;
-      TT.rgl.zspr = xrealloc(TT.rgl.zspr, sizeof(*TT.rgl.zspr) + cap);
-      TT.rgl.zspr->capacity = cap;
-    }
-  vsnprintf(TT.rgl.zspr->str + TT.rgl.zspr->size, len+1, fmt, args2);
-  TT.rgl.zspr->size += len;
-  TT.rgl.zspr->str[TT.rgl.zspr->size] = 0;
+  // On error (e.g. %c of a bad char) add nothing, as fprintf() would
+  if (len >= 0) {
+    if ((size_t)len >= room) vsnprintf(spr_room(len), len+1, fmt, args2);
+    spr_added(len);
+  } else TT.rgl.zspr->str[TT.rgl.zspr->size] = 0;
   va_end(args2);
-  return 0;
 }
 
-static void varprint(int(*fpvar)(FILE *, const char *, ...), FILE *outfp, int nargs)
+// printf/sprintf formats are compiled on first use into a list of items,
+// each literal text or one conversion spec, and cached by format string.
+// Common simple conversions (%s %d %i %x %f, with only - or 0 flags and
+// width, and precision for %f) are done by fast_conv(), not vsnprintf().
+struct pfmt_item {
+  char conv;        // conversion char; 0 for literal text
+  char nargs;       // args used: the value plus one per '*'
+  char fast;        // can use fast_conv()
+  char left, zero;  // '-' and '0' flags, for fast_conv()
+  int width, prec;  // for fast_conv(); prec is -1 if none
+  size_t off, len;  // literal text, or spec for vsnprintf(), in pfmt->text
+};
+
+struct pfmt {
+  int nitems;
+  char *text;
+  struct pfmt_item item[];
+};
+
+#define PFMT_CACHE_MAX  256   // compiled formats kept
+
+static struct pfmt *compile_pfmt(char *fmt)
 {
-  int k, nn, nnc, fmtc, holdc, cnt1 = 0, cnt2 = 0;
-  char *s = 0;  // to shut up spurious warning
   regoff_t offs = -1, e = -1;
-  char *pfmt, *fmt = to_str(STKP-nargs+1)->vst->str;
-  k = stkn(nargs - 2);
+  size_t len = strlen(fmt), npct = 0, tlen = 0;
+  for (char *p = fmt; (p = strchr(p, '%')); p++) npct++;
+  struct pfmt *pf = xzalloc(sizeof(*pf) + (2 * npct + 1) * sizeof(pf->item[0])
+      + len + 2 * npct + 1);
+  char *text = pf->text = (char *)&pf->item[2 * npct + 1];
+  struct pfmt_item *it = pf->item - 1;
   while (*fmt) {
-    double n = 0;
-    nn = strcspn(fmt, "%");
+    size_t nn = strcspn(fmt, "%"), nnc;
+    if (*fmt == '%' && fmt[1] == '%') nn = 1;   // %% is just literal %
     if (nn) {
-      holdc = fmt[nn];
-      fmt[nn] = 0;
-      fpvar(outfp, "%s", fmt);
-      fmt[nn] = holdc;
+      if (it < pf->item || it->conv) (++it)->off = tlen;
+      memcpy(text + tlen, fmt, nn);
+      tlen += nn;
+      it->len += nn;
+      fmt += nn + (*fmt == '%');
+      continue;
     }
-    fmt += nn;
-    if (!*(pfmt = fmt)) break;
     nnc = strcspn(fmt+1, "aAdiouxXfFeEgGcs%");
-    fmtc = fmt[nnc+1];
+    int fmtc = fmt[nnc+1];
     if (!fmtc) FFATAL("bad printf format '%s'", fmt);
-    holdc = fmt[nnc+2];
-    fmt[nnc+2] = 0;
-    if (rx_find(&TT.rx_printf_fmt, fmt, &offs, &e, 0))
-      FFATAL("bad printf format <%s>\n", fmt);
-    int nargsneeded = 1;
-    for (char *p = strchr(fmt, '*'); p; p = strchr(p+1, '*'))
-      nargsneeded++;
-    nargsneeded -= fmtc == '%';
-
-    switch (nargsneeded) {
+    char *spec = text + tlen;
+    memcpy(spec, fmt, nnc + 2);
+    spec[nnc+2] = 0;
+    if (rx_find(&TT.rx_printf_fmt, spec, &offs, &e, 0))
+      FFATAL("bad printf format <%s>\n", spec);
+    it++;
+    it->conv = fmtc;
+    it->off = tlen;
+    it->nargs = fmtc != '%';
+    for (char *p = strchr(spec, '*'); p; p = strchr(p+1, '*'))
+      it->nargs++;
+    if (strchr("cdiouxX", fmtc) && spec[nnc] != 'l') {
+      spec[nnc+1] = 'l';
+      spec[nnc+2] = fmtc;
+      spec[nnc+3] = 0;
+    }
+    tlen += it->len = strlen(spec);
+    tlen++;
+    fmt += nnc + 2;
+
+    // Simple enough for fast_conv()?
+    char *p = spec + 1;
+    for (; *p == '-' || *p == '0'; p++) {
+      if (*p == '-') it->left = 1;
+      else it->zero = 1;
+    }
+    if (p[strspn(p, "0123456789.")] != fmtc) continue;
+    it->width = strtol(p, &p, 10);
+    it->prec = *p == '.' ? (int)strtol(p+1, &p, 10) : -1;
+    it->fast = it->nargs == 1 && it->width < 1000
+      && (strchr("dix", fmtc) ? it->prec < 0 : fmtc == 's' ? it->prec < 0
+          && !it->zero : fmtc == 'f' && it->prec < 10
+          && decimal_dot);
+    if (fmtc == 'f' && it->prec < 0) it->prec = 6;
+  }
+  pf->nitems = it + 1 - pf->item;
+  return pf;
+}
+
+static struct pfmt *get_pfmt(struct zstring *fmt)
+{
+  struct zvalue *v;
+  if (!TT.pfmt_map) {
+    struct zvalue m = uninit_zvalue;
+    zvalue_map_init(&m);
+    TT.pfmt_map = m.map;
+    zlist_init(&TT.pfmts, sizeof(struct pfmt *));
+  } else if ((v = zmap_find(TT.pfmt_map, fmt)))
+    return ((struct pfmt **)TT.pfmts.base)[(int)v->num];
+  if (zlist_len(&TT.pfmts) == PFMT_CACHE_MAX) {   // full; start over
+    for (int k = 0; k < PFMT_CACHE_MAX; k++)
+      xfree(((struct pfmt **)TT.pfmts.base)[k]);
+    TT.pfmts.avail = TT.pfmts.base;
+    zmap_delete_map(TT.pfmt_map);
+  }
+  struct pfmt *pf = compile_pfmt(fmt->str);
+  struct zmap_slot *x = zmap_find_or_insert_key(TT.pfmt_map, fmt);
+  x->val = (struct zvalue)ZVINIT(ZF_NUM, zlist_append(&TT.pfmts, &pf), 0);
+  return pf;
+}
+
+// Format d as %.precf ending at e; return start, or 0 if it might not round
+// exactly as printf() would (then vsnprintf() must do it).
+static char *fixed_digits(char *e, double d, int prec)
+{
+  double t = fabs(d) * p10[prec], fl = floor(t), fr = t - fl;
+  // t is within t * 2^-53 of the exact product; give up if too big for the
+  // fraction to mean anything, or near a tie (or NaN or infinite).
+  if (!(t < 1e15) || fabs(fr - 0.5) <= t * 0x1p-52) return 0;
+  unsigned long long r = fl + (fr > 0.5);
+  for (int k = 0; k < prec; k++, r /= 10) *--e = '0' + r % 10;
+  if (prec) *--e = '.';
+  do *--e = '0' + r % 10; while (r /= 10);
+  if (signbit(d)) *--e = '-';
+  return e;
+}
+
+// Do a simple conversion; return 0 if it must be done by vsnprintf().
+static int fast_conv(struct pfmt_item *it, struct zvalue *v)
+{
+  char buf[64], *e = buf + sizeof(buf), *s = e;
+  if (it->conv == 's') s = to_str(v)->vst->str, e = s + strlen(s);
+  else {
+    double d = to_num(v);
+    if (it->conv == 'f') {
+      if (!(s = fixed_digits(e, d, it->prec))) return 0;
+    } else if (it->conv == 'x') s = ulong_digits(e, (unsigned long)d, 16);
+    else {
+      long n = (long)d;
+      s = ulong_digits(e, n < 0 ? -(unsigned long)n : (unsigned long)n, 10);
+      if (n < 0) *--s = '-';
+    }
+  }
+  size_t n = e - s, w = maxof(n, (size_t)it->width), pad = w - n;
+  char *p = spr_room(w);
+  if (it->left) {
+    memcpy(p, s, n);
+    memset(p + n, ' ', pad);
+  } else {
+    if (it->zero && *s == '-') *p++ = *s++, n--;
+    memset(p, it->zero ? '0' : ' ', pad);
+    memcpy(p + pad, s, n);
+  }
+  spr_added(w);
+  return 1;
+}
+
+// Format printf/sprintf args onto TT.rgl.zspr
+static void varprint(int nargs)
+{
+  int k, cnt1 = 0, cnt2 = 0;
+  char *s = 0;  // to shut up spurious warning
+  struct pfmt *pf = get_pfmt(to_str(STKP-nargs+1)->vst);
+  k = stkn(nargs - 2);
+  for (struct pfmt_item *it = pf->item; it < pf->item + pf->nitems; it++) {
+    double n = 0;
+    char *pfmt = pf->text + it->off;
+    int fmtc = it->conv;
+    if (!fmtc) {
+      memcpy(spr_room(it->len), pfmt, it->len);
+      spr_added(it->len);
+      continue;
+    }
+    if (it->fast && k <= stkn(0) && fast_conv(it, &STACK[k])) {
+      k++;
+      continue;
+    }
+    switch (it->nargs) {
       case 0:
-        fpvar(outfp, fmt);
+        fsprintf(pfmt);
         break;
       case 3:
         cnt1 = getcnt(k++);
@@ -3160,7 +4829,7 @@ static void varprint(int(*fpvar)(FILE *, const char *, ...), FILE *outfp, int na
         if (k > stkn(0)) FATAL("too few args for printf\n");
         if (fmtc == 's') {
           s = to_str(&STACK[k++])->vst->str;
-        } else if (fmtc == 'c' && !IS_NUM(&STACK[k])) {
+        } else if (fmtc == 'c' && (numstr_check(&STACK[k]), !IS_NUM(&STACK[k]))) {
           unsigned wch;
           struct zvalue *z = &STACK[k++];
           if (z->vst && z->vst->str[0])
@@ -3168,43 +4837,34 @@ static void varprint(int(*fpvar)(FILE *, const char *, ...), FILE *outfp, int na
         } else {
           n = to_num(&STACK[k++]);
         }
-        if (strchr("cdiouxX", fmtc)) {
-          pfmt = strcpy(TT.pbuf, fmt);
-          if (pfmt[nnc] != 'l') {
-            strcpy(pfmt+nnc+1, "l_");
-            pfmt[nnc+2] = fmtc;
-          }
-        }
         if (fmtc == 'c' && n > 0x10ffff) n = 0xfffd;  // musl won't take larger "wchar"
-        switch (nargsneeded) {
+        switch (it->nargs) {
           case 1:
-            if (fmtc == 's') fpvar(outfp, pfmt, s);
-            else if (fmtc == 'c') fpvar(outfp, pfmt, (wint_t)n);
-            else if (strchr("di", fmtc)) fpvar(outfp, pfmt, (long)n);
-            else if (strchr("ouxX", fmtc)) fpvar(outfp, pfmt, (unsigned long)n);
-            else fpvar(outfp, pfmt, n);
+            if (fmtc == 's') fsprintf(pfmt, s);
+            else if (fmtc == 'c') fsprintf(pfmt, (wint_t)n);
+            else if (strchr("di", fmtc)) fsprintf(pfmt, (long)n);
+            else if (strchr("ouxX", fmtc)) fsprintf(pfmt, (unsigned long)n);
+            else fsprintf(pfmt, n);
             break;
           case 2:
-            if (fmtc == 's') fpvar(outfp, pfmt, cnt2, s);
-            else if (fmtc == 'c') fpvar(outfp, pfmt, cnt2, (wint_t)n);
-            else if (strchr("di", fmtc)) fpvar(outfp, pfmt, cnt2, (long)n);
-            else if (strchr("ouxX", fmtc)) fpvar(outfp, pfmt, cnt2, (unsigned long)n);
-            else fpvar(outfp, pfmt, cnt2, n);
+            if (fmtc == 's') fsprintf(pfmt, cnt2, s);
+            else if (fmtc == 'c') fsprintf(pfmt, cnt2, (wint_t)n);
+            else if (strchr("di", fmtc)) fsprintf(pfmt, cnt2, (long)n);
+            else if (strchr("ouxX", fmtc)) fsprintf(pfmt, cnt2, (unsigned long)n);
+            else fsprintf(pfmt, cnt2, n);
             break;
           case 3:
-            if (fmtc == 's') fpvar(outfp, pfmt, cnt1, cnt2, s);
-            else if (fmtc == 'c') fpvar(outfp, pfmt, cnt1, cnt2, (wint_t)n);
-            else if (strchr("di", fmtc)) fpvar(outfp, pfmt, cnt1, cnt2, (long)n);
-            else if (strchr("ouxX", fmtc)) fpvar(outfp, pfmt, cnt1, cnt2, (unsigned long)n);
-            else fpvar(outfp, pfmt, cnt1, cnt2, n);
+            if (fmtc == 's') fsprintf(pfmt, cnt1, cnt2, s);
+            else if (fmtc == 'c') fsprintf(pfmt, cnt1, cnt2, (wint_t)n);
+            else if (strchr("di", fmtc)) fsprintf(pfmt, cnt1, cnt2, (long)n);
+            else if (strchr("ouxX", fmtc)) fsprintf(pfmt, cnt1, cnt2, (unsigned long)n);
+            else fsprintf(pfmt, cnt1, cnt2, n);
             break;
         }
         break;
       default:
         FATAL("bad printf format\n");
     }
-    fmt += nnc + 2;
-    *fmt = holdc;
   }
 }
 
@@ -3224,6 +4884,8 @@ static int assign_global(char *var, char *value)
   int globals_ent = find_global(var);
   if (globals_ent) {
     struct zvalue *v = &STACK[globals_ent];
+    if (globals_ent == FS || globals_ent == FIELDWIDTHS)
+      TT.fw_mode = globals_ent == FIELDWIDTHS;
     if (IS_MAP(v)) error_exit("-v assignment to array");  // Maybe not needed?
 
 // The compile phase may insert a var in global table with flag of zero.  Then
@@ -3286,24 +4948,51 @@ static char *nextfilearg(void)
   return arg;
 }
 
+// Have the OS start reading the next file in ARGV (if it is a regular
+// file) while this one is processed. ARGV may still change; it's a hint.
+static void prefetch_next_arg(void)
+{
+#ifndef NO_FADVISE
+  struct stat st;
+  struct zvalue zkey = ZVINIT(ZF_STR, 0, num_to_zstring(TT.rgl.narg + 1,
+        to_str(&STACK[CONVFMT])->vst->str));
+  int fd;
+  if (TT.rgl.narg + 1 < (int)to_num(&STACK[ARGC])
+      && zmap_find(STACK[ARGV].map, zkey.vst)) {
+    char *fn = to_str(get_map_val(&STACK[ARGV], &zkey))->vst->str;
+    if (*fn && !strchr(fn, '=') && !stat(fn, &st) && S_ISREG(st.st_mode)
+        && (fd = open(fn, O_RDONLY)) >= 0) {
+      posix_fadvise(fd, 0, READ_AHEAD, POSIX_FADV_WILLNEED);
+      close(fd);
+    }
+  }
+  zvalue_release_zstring(&zkey);
+#endif  // NO_FADVISE
+}
+
 static int next_fp(void)
 {
   char *fn = nextfilearg();
   if (TT.cfile->fp && TT.cfile->fp != stdin) fclose(TT.cfile->fp);
   if ((!fn && !TT.rgl.nfiles && TT.cfile->fp != stdin) || (fn && !strcmp(fn, "-"))) {
-    xfree(TT.cfile->buf);
+    free_file_buf(TT.cfile);
     *TT.cfile = (struct zfile){0};
     TT.cfile->fp = stdin;
     TT.cfile->fn = "-";
     zvalue_release_zstring(&STACK[FILENAME]);
     STACK[FILENAME].vst = new_zstring("-", 1);
   } else if (fn) {
-    xfree(TT.cfile->buf);
+    free_file_buf(TT.cfile);
     *TT.cfile = (struct zfile){0};
-    if (!(TT.cfile->fp = fopen(fn, "r"))) FFATAL("can't open %s\n", fn);
+    if (!(TT.cfile->fp = open_file(fn, 1, "r"))) FFATAL("can't open %s\n", fn);
     TT.cfile->fn = fn;
+#ifndef NO_FADVISE
+    posix_fadvise(fileno(TT.cfile->fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif  // NO_FADVISE
+    prefetch_next_arg();
     zvalue_copy(&STACK[FILENAME], &TT.rgl.cur_arg);
   } else {
+    TT.cfile->fp = 0;
     TT.rgl.eof = 1;
     return 0;
   }
@@ -3312,22 +5001,80 @@ static int next_fp(void)
   return 1;
 }
 
-static int rx_find_rs(regex_t *rx, char *s, long len,
-                      regoff_t *start, regoff_t *end, int one_byte_rs)
+// RS matcher types. The matcher is rebuilt only when RS changes.
+enum rs_modes { RS_BYTE = 1, RS_LITERAL, RS_PARA, RS_REGEX, RS_CSV,
+    RS_RECLEN };
+
+// Set up RS matcher for current RS value; return RS mode.
+// If RECLEN > 0, records are RECLEN bytes each and RS is ignored.
+static int rs_prep(void)
 {
-  regmatch_t matches[1];
-  if (one_byte_rs) {
-    char *p = memchr(s, one_byte_rs, len);
-    if (!p) return REG_NOMATCH;
-    *start = p - s;
-    *end = *start + 1;
-  } else {
-    int r = regexec0(rx, s, len, 1, matches, 0);
-    if (r == REG_NOMATCH) return r;
-    if (r) FATAL("regexec error");  // TODO ? use regerr() to meaningful msg
-    *start = matches[0].rm_so;
-    *end = matches[0].rm_eo;
+  double reclen = to_num(&STACK[RECLEN]);
+  if (reclen >= 1) {
+    if (reclen > INT_MAX) FFATAL("bad RECLEN %.0f\n", reclen);
+    TT.reclen = reclen;
+    return RS_RECLEN;
+  }
+  if (FLAG(csv)) return RS_CSV;   // RS is ignored
+  struct zstring *rs = ENSURE_STR(&STACK[RS])->vst;
+  if (rs == TT.rs_last || (TT.rs_last && zstring_match(rs, TT.rs_last)))
+    return TT.rs_mode;
+  if (TT.rs_mode == RS_REGEX) regfree(&TT.rx_rs_last);
+  zstring_release(&TT.rs_last);
+  // Holding a reference keeps the zstring from being modified in place.
+  zstring_incr_refcnt(TT.rs_last = rs);
+  if (!rs->size) return TT.rs_mode = RS_PARA;
+  if (rs->size == 1) return TT.rs_mode = RS_BYTE;
+  TT.rs_mode = RS_LITERAL;
+  for (size_t k = 0; k < rs->size; k++)
+    if (rs->str[k] && strchr("\\^$.[]|()*+?{}", rs->str[k]))
+      TT.rs_mode = RS_REGEX;
+  if (TT.rs_mode == RS_REGEX) xregcomp(&TT.rx_rs_last, rs->str, REG_EXTENDED);
+  return TT.rs_mode;
+}
+
+static int rx_find_rs(char *s, size_t len, size_t *start, size_t *end,
+                      int rs_mode)
+{
+  char *p = 0, *lim = s + len;
+  int in_q = 0;
+  switch (rs_mode) {
+    case RS_BYTE:
+      p = memchr(s, TT.rs_last->str[0], len);
+      *end = 1;
+      break;
+    case RS_LITERAL:
+      p = mem_find(s, len, TT.rs_last->str, TT.rs_last->size);
+      *end = TT.rs_last->size;
+      break;
+    case RS_PARA:
+      // Same as regex "\n\n+" but much faster
+      for (p = s; (p = memchr(p, '\n', lim - p)) && p + 1 < lim; p += 2) {
+        if (p[1] != '\n') continue;
+        char *q = p + 2;
+        while (q < lim && *q == '\n') q++;
+        *end = q - p;
+        break;
+      }
+      if (p && p + 1 >= lim) p = 0;
+      break;
+    case RS_CSV:
+      // A newline (or CR-LF) not inside quotes; each stretch up to the
+      // next newline is checked for quotes with memchr(). A doubled quote
+      // inside quotes flips the state twice, so needs no special case.
+      for (char *t = s; (p = memchr(t, '\n', lim - t)); t = p + 1) {
+        for (char *q = t; (q = memchr(q, '"', p - q)); q++) in_q ^= 1;
+        if (!in_q) break;
+      }
+      *end = 1;
+      if (p && p > s && p[-1] == '\r') p--, *end = 2;
+      break;
+    default:
+      return rx_findn(&TT.rx_rs_last, s, len, start, end, 0);
   }
+  if (!p) return REG_NOMATCH;
+  *start = p - s;
+  *end += *start;
   return 0;
 }
 
@@ -3340,46 +5087,70 @@ static ssize_t getr(struct zfile *zfp, int rs_mode)
   // TT.rgl.recptr -- points to where record is being / has been read into
   // zfp->ro -- offset in buf to record data
   // zfp->lim -- offset to 1+last byte read in buffer
-  // rs_mode nonzero iff multiline mode; reused for one-byte RS
+  // rs_mode is from rs_prep()
 
-  regex_t rsrx; // FIXME Need to cache and avoid rx compile on every record?
   long ret = -1;
   int r = -REG_NOMATCH;   // r cannot have this value after rx_findx() below
-  regoff_t so = 0, eo = 0;
-  size_t m = 0, n = 0;
+  size_t so = 0, eo = 0, m = 0;
+  ssize_t n = 0;
+
+  // A regular file is mapped whole; it then looks like a buffer holding
+  // the rest of the file at EOF, so no reads or buffer slides happen.
+  if (!zfp->buf && !zfp->eof) map_file(zfp);
+  else if (zfp->is_mapped && zfp->ahead < zfp->ro + READ_AHEAD) read_ahead(zfp);
 
-  xregcomp(&rsrx, rs_mode ? "\n\n+" : fmt_one_char_fs(STACK[RS].vst->str),
-      REG_EXTENDED);
-  rs_mode = strlen(STACK[RS].vst->str) == 1 ? STACK[RS].vst->str[0] : 0;
   for ( ;; ) {
+#ifndef NO_MMAP
+    if (map_cut) map_end_at_cut(zfp);
+#endif  // NO_MMAP
     if (zfp->ro == zfp->lim && zfp->eof) break; // EOF & last record; return -1
 
     // Allocate initial buffer, and expand iff buffer holds one
     //   possibly (probably) incomplete record.
-    if (zfp->ro == 0 && zfp->lim == zfp->buflen)
+    if (zfp->ro == 0 && zfp->lim == zfp->buflen && !zfp->is_mapped) {
+      own_field0(zfp);
       zfp->buf = xrealloc(zfp->buf,
-          (zfp->buflen = maxof(512, zfp->buflen * 2)) + 1);
+          (zfp->buflen = maxof(zfp->is_tty ? 512 : READ_BUF_MIN,
+                               zfp->buflen * 2)) + 1);
+    }
 
-    if ((m = zfp->buflen - zfp->lim) && !zfp->eof) {
-      // Read iff space left in buffer
+    // Read iff space left in buffer, and no data left or more data needed.
+    // read() returns what a pipe has ready; a complete record in it is
+    // returned without waiting for the buffer to fill.
+    if ((m = zfp->buflen - zfp->lim) && !zfp->eof
+        && (zfp->ro == zfp->lim || r != -REG_NOMATCH)) {
       if (zfp->is_tty) m = 1;
-      n = fread(zfp->buf + zfp->lim, 1, m, zfp->fp);
-      if (n < m) {
-        if (ferror(zfp->fp)) FFATAL("i/o error %d on %s!", errno, zfp->fn);
+      while ((n = read(fileno(zfp->fp), zfp->buf + zfp->lim, m)) < 0
+          && errno == EINTR) continue;
+      if (n < 0) FFATAL("i/o error %d on %s!", errno, zfp->fn);
+      if (!n) {
         zfp->eof = 1;
-        if (!n && r == -REG_NOMATCH) break; // catch empty file here
+        if (zfp->ro == zfp->lim) break; // catch empty file here
       }
       zfp->lim += n;
       zfp->buf[zfp->lim] = 0;
     }
     TT.rgl.recptr = zfp->buf + zfp->ro;
-    r = rx_find_rs(&rsrx, TT.rgl.recptr, zfp->lim - zfp->ro, &so, &eo, rs_mode);
-    if (!r && so == eo) r = 1;  // RS was empty, so fake not found
+    if (rs_mode == RS_RECLEN) {   // no search; is the record all here?
+      r = zfp->lim - zfp->ro < TT.reclen;
+      so = eo = TT.reclen;
+    } else {
+      r = rx_find_rs(TT.rgl.recptr, zfp->lim - zfp->ro, &so, &eo, rs_mode);
+      if (!r && so == eo) r = 1;  // RS was empty, so fake not found
+    }
+#ifndef NO_MMAP
+    if (map_cut && map_end_at_cut(zfp)) continue;  // search hit a cut
+#endif  // NO_MMAP
 
+    // A byte or literal RS match (or RECLEN record) is final. A regex match
+    // near lim may be incomplete, as may a run of newlines ending at lim in
+    // multiline mode.
     if (!zfp->eof && (r
-          || (zfp->lim - (zfp->ro + eo)) < zfp->buflen / 4) && !zfp->is_tty) {
+          || (rs_mode == RS_REGEX && (zfp->lim - (zfp->ro + eo)) < zfp->buflen / 4)
+          || (rs_mode == RS_PARA && zfp->ro + eo == zfp->lim)) && !zfp->is_tty) {
       // RS not found, or found near lim. Slide up and try to get more data
       // If recptr at start of buf and RS not found then expand buffer
+      own_field0(zfp);
       memmove(zfp->buf, TT.rgl.recptr, zfp->lim - zfp->ro);
       zfp->lim -= zfp->ro;
       zfp->ro = 0;
@@ -3390,6 +5161,8 @@ static ssize_t getr(struct zfile *zfp, int rs_mode)
       if (r) {  // EOF and RS not found; rec is all data left in buf
         ret = zfp->lim - zfp->ro;
         zfp->ro = zfp->lim; // set ro for -1 return on next call
+        // A byte or literal RS may yet end it, if the file grows
+        if (rs_mode == RS_BYTE || rs_mode == RS_LITERAL) zfp->partial = ret;
       } else zfp->ro += eo; // RS found; advance ro
     } else zfp->ro += eo; // Here only if RS found not near lim
 
@@ -3400,24 +5173,24 @@ static ssize_t getr(struct zfile *zfp, int rs_mode)
       break;
     } // RS not found AND is_tty; loop to keep reading
   }
-  regfree(&rsrx);
   return ret;
 }
 
 // get a record; return length, or -1 at EOF
 static ssize_t getrec_f(struct zfile *zfp)
 {
-  int k;
-  if (ENSURE_STR(&STACK[RS])->vst->str[0]) return getr(zfp, 0);
+  ssize_t k;
+  int rs_mode = rs_prep();
+  if (rs_mode != RS_PARA) return getr(zfp, rs_mode);
   // RS == "" so multiline read
-  // Passing 1 to getr() forces multiline mode, which uses regex "\n\n+" to
-  // split on sequences of 2 or more newlines. But that's not the same as
-  // multiline mode, which never returns empty records or records with leading
-  // or trailing newlines, which can occur with RS="\n\n+". So here we loop and
-  // strip leading/trailing newlines and discard empty lines. See gawk manual,
+  // RS_PARA mode splits on sequences of 2 or more newlines, like regex
+  // "\n\n+". But that's not the same as multiline mode, which never returns
+  // empty records or records with leading or trailing newlines, which can
+  // occur with RS="\n\n+". So here we loop and strip leading/trailing
+  // newlines and discard empty lines. See gawk manual,
   // "4.9 Multiple-Line Records" for info on this difference.
   do {
-    k = getr(zfp, 1);
+    k = getr(zfp, rs_mode);
     if (k < 0) break;
     while (k && TT.rgl.recptr[k-1] == '\n') k--;
     while (k && TT.rgl.recptr[0] == '\n') k--, TT.rgl.recptr++;
@@ -3440,7 +5213,7 @@ static ssize_t getrec_f0_f(struct zfile *zfp)
 {
   ssize_t k = getrec_f(zfp);
   if (k >= 0) {
-    copy_to_field0(TT.rgl.recptr, k);
+    set_field0(zfp, TT.rgl.recptr, k);
   }
   return k;
 }
@@ -3449,7 +5222,7 @@ static ssize_t getrec_f0(void)
 {
   ssize_t k = getrec();
   if (k >= 0) {
-    copy_to_field0(TT.rgl.recptr, k);
+    set_field0(TT.cfile, TT.rgl.recptr, k);
     incr_zvalue(&STACK[NR]);
     incr_zvalue(&STACK[FNR]);
   }
@@ -3467,9 +5240,7 @@ static int awk_getline(int source, struct zfile *zfp, struct zvalue *v)
   if (is_stream && !zfp->fp) return -1;
   if (v) {
     if ((k = is_stream ? getrec_f(zfp) : getrec()) < 0) return 0;
-    zstring_release(&v->vst);
-    v->vst = new_zstring(TT.rgl.recptr, k);
-    v->flags = ZF_STR;
+    set_zvalue_str(v, TT.rgl.recptr, k);
     check_numeric_string(v);    // bug fix 20240514
     if (!is_stream) {
       incr_zvalue(&STACK[NR]);
@@ -3501,8 +5272,7 @@ static void gsub(int opcode, int nargs, int parmbase)
   struct zvalue *v = setup_lvalue(0, parmbase, &field_num);
   struct zvalue *ere = STKP-2;
   struct zvalue *repl = STKP-1;
-  regex_t rx, *rxp = &rx;
-  rx_zvalue_compile(&rxp, ere);
+  struct zregex *zr = rx_zvalue_compile(ere);
   to_str(repl);
   to_str(v);
 
@@ -3512,10 +5282,11 @@ static void gsub(int opcode, int nargs, int parmbase)
   regoff_t so = -1, eo;
   // Count ampersands in repl string; may be overcount due to \& escapes.
   for (rp = rp0; *rp; rp++) namps += *rp == '&';
+  size_t slen = strlen(s);
   p = s;
-  regoff_t need = SLEN(v) + 1;  // capacity needed for result string
+  size_t need = SLEN(v) + 1;  // capacity needed for result string
   // A pass just to determine needed destination (result) string size.
-  while(!rx_find(rxp, p, &so, &eo, eflags)) {
+  while(!zrx_find(zr, p, slen - (p - s), &so, &eo, eflags)) {
     need += SLEN(repl) + (eo - so) * (namps - 1);
     if (!*p) break;
     p += eo ? eo : 1; // ensure progress if empty hit at start
@@ -3531,7 +5302,7 @@ static void gsub(int opcode, int nargs, int parmbase)
     p = s;
     eflags = 0;
     char *ep0 = p, *sp, *ep;
-    while(!rx_find(rxp, p, &so, &eo, eflags)) {
+    while(!zrx_find(zr, p, slen - (p - s), &so, &eo, eflags)) {
       sp = p + so;
       ep = p + eo;
       memmove(e, ep0, sp - ep0);  // copy unchanged part
@@ -3572,11 +5343,13 @@ static void gsub(int opcode, int nargs, int parmbase)
     zstring_release(&v->vst);
     v->vst = z;
   }
-  rx_zvalue_free(rxp, ere);
-  if (!IS_RX(STKP-2)) zstring_release(&STKP[-2].vst);
   drop_n(3);
   push_int_val(nhits);
-  if (field_num >= 0) fixup_fields(field_num);
+  // With no change, $0 or the fields need no rebuilding, but a field
+  // must again be checked for a numeric string after to_str() above.
+  if (field_num >= 0 && !nhits && field_num != THIS_MEANS_SET_NF) {
+    if (field_num) check_numeric_string(v);
+  } else if (field_num >= 0) fixup_fields(field_num);
 }
 
 // Initially set stackp_needmore at MIN_STACK_LEFT before limit.
@@ -3673,6 +5446,8 @@ static int interpx(int start, int *status)
       case tkgt:          // FALLTHROUGH intentional here
       case tkge:
         ; int cmp = 31416;
+        numstr_check(&STKP[-1]);
+        numstr_check(&STKP[0]);
 
         if (  (IS_NUM(&STKP[-1]) &&
               (STKP[0].flags & (ZF_NUM | ZF_NUMSTR) || !STKP[0].flags)) ||
@@ -3704,7 +5479,10 @@ static int interpx(int start, int *status)
 
       case opmatchrec:
         op2 = *ip++;
-        int mret = match(&FIELD[0], &LITERAL[op2]);
+        if (TT.rgl.field0_stale) rebuild_field0();
+        int mret = TT.rgl.rec0
+            ? match_str(TT.rgl.rec0, TT.rgl.rec0len, &LITERAL[op2])
+            : match(&FIELD[0], &LITERAL[op2]);
         push_int_val(!mret);
         break;
 
@@ -3807,38 +5585,60 @@ static int interpx(int start, int *status)
       case tkprintf:
         nargs = *ip++;
         int outmode = *ip++;
+        int slot = *ip++;
         struct zfile *outfp = TT.zstdout;
         switch (outmode) {
-          case tkgt: outfp = setup_file(1, "w"); break;     // file
-          case tkappend: outfp = setup_file(1, "a"); break; // file
-          case tkpipe: outfp = setup_file(0, "w"); break;   // pipe
-          default: nargs++; break;
+          case tkgt: outfp = setup_file(1, "w", slot); break;     // file
+          case tkappend: outfp = setup_file(1, "a", slot); break; // file
+          case tkpipe: outfp = setup_file(0, "w", slot); break;   // pipe
+          default: break;
         }
-        nargs--;
+        if (outmode && slot < 0) nargs--;   // file name was stacked
         if (opcode == tkprintf) {
-          varprint(fprintf, outfp->fp, nargs);
+          if (TT.rgl.zspr && !TT.rgl.zspr->refcnt) {  // no other refs; reuse
+            TT.rgl.zspr->size = 0;
+            TT.rgl.zspr->str[0] = 0;
+          } else {
+            zstring_release(&TT.rgl.zspr);
+            TT.rgl.zspr = new_zstring("", 0);
+          }
+          varprint(nargs);
           drop_n(nargs);
-          break;
-        }
-        if (!nargs) {
-          fprintf(outfp->fp, "%s", to_str(&FIELD[0])->vst->str);
+          out_write(outfp, TT.rgl.zspr->str, TT.rgl.zspr->size);
         } else {
-          struct zvalue tempv = uninit_zvalue;
-          zvalue_copy(&tempv, &STACK[OFS]);
-          to_str(&tempv);
-          for (int k = 0; k < nargs; k++) {
-            if (k) fprintf(outfp->fp, "%s", tempv.vst->str);
-            int sp = stkn(nargs - 1 - k);
-            ////// FIXME refcnt -- prob. don't need to copy from TT.stack?
-            v = &STACK[sp];
-            to_str_fmt(v, OFMT);
-            struct zstring *zs = v->vst;
-            fprintf(outfp->fp, "%s", zs ? zs->str : "");
+          if (!nargs) {
+            if (TT.rgl.rec0) out_write(outfp, TT.rgl.rec0, TT.rgl.rec0len);
+            else {
+              own_field0(0);
+              struct zstring *zs = to_str(&FIELD[0])->vst;
+              out_write(outfp, zs->str, zs->size);
+            }
+          } else {
+            struct zvalue tempv = uninit_zvalue;
+            zvalue_copy(&tempv, &STACK[OFS]);
+            to_str(&tempv);
+            for (int k = 0; k < nargs; k++) {
+              if (k) out_write(outfp, tempv.vst->str, tempv.vst->size);
+              int sp = stkn(nargs - 1 - k);
+              ////// FIXME refcnt -- prob. don't need to copy from TT.stack?
+              v = &STACK[sp];
+              if (v->flags == ZF_NUM) {   // number; format it w/o a zstring
+                int n = num_to_buf(TT.pbuf, v->num, fmt_str(OFMT));
+                out_write(outfp, TT.pbuf, n);
+                continue;
+              }
+              to_str_fmt(v, OFMT);
+              struct zstring *zs = v->vst;
+              if (zs) out_write(outfp, zs->str, zs->size);
+            }
+            zvalue_release_zstring(&tempv);
+            drop_n(nargs);
           }
-          zvalue_release_zstring(&tempv);
-          drop_n(nargs);
+          struct zstring *zs = ENSURE_STR(&STACK[ORS])->vst;
+          out_write(outfp, zs->str, zs->size);
         }
-        fputs(ENSURE_STR(&STACK[ORS])->vst->str, outfp->fp);
+        // Like stdio: unbuffered stderr, line buffered tty
+        if (outfp->is_tty || outfp->fp == stderr) flush_out(outfp);
         break;
 
       case opdrop:
@@ -3973,6 +5773,7 @@ static int interpx(int start, int *status)
         if (!IS_MAP(v)) FATAL("scalar in array context");
         v = get_map_val(v, STKP);
         drop();     // drop subscript
+        numstr_check(v);  // once here, not in each copy pushed
         push_val(v);
         break;
 
@@ -4009,6 +5810,7 @@ static int interpx(int start, int *status)
         op2 = *ip++;
         k = op2 < 0 ? parmbase - op2 : op2;
         v = &STACK[k];
+        numstr_check(v);  // once here, not in each copy pushed
         push_val(v);
         break;
 
@@ -4016,7 +5818,7 @@ static int interpx(int start, int *status)
         // tkfield op has "dummy" 2nd word so that convert_push_to_reference(void)
         // can find either tkfield or tkvar at same place (ZCODE[TT.zcode_last-1]).
         ip++; // skip dummy "operand" instruction field
-        push_field((int)(to_num(STKP)));
+        push_field(to_field_num(to_num(STKP)));
 
         swap();
         drop();
@@ -4079,7 +5881,14 @@ static int interpx(int start, int *status)
         break;
 
       case opprintrec:
-        puts(to_str(&FIELD[0])->vst->str);
+        if (TT.rgl.rec0) out_write(TT.zstdout, TT.rgl.rec0, TT.rgl.rec0len);
+        else {
+          own_field0(0);
+          struct zstring *zs = to_str(&FIELD[0])->vst;
+          out_write(TT.zstdout, zs->str, zs->size);
+        }
+        out_write(TT.zstdout, "\n", 1);
+        if (TT.zstdout->is_tty) flush_out(TT.zstdout);
         break;
 
       case oprange1:
@@ -4116,6 +5925,7 @@ static int interpx(int start, int *status)
       case tkgetline:
         nargs = *ip++;
         int source = *ip++;
+        slot = *ip++;   // file table slot if constant file name, else -1
         // TT.stack is:
         // if tkgetline 0 tkeof:   (nothing stacked; plain getline)
         // if tkgetline 1 tkeof:   (lvalue)
@@ -4130,12 +5940,13 @@ static int interpx(int start, int *status)
         // if tkgetline 2 tklt:    var
         // if tkgetline 1 tkpipe:  $0 NF
         // if tkgetline 2 tkpipe:  var
+        // (A constant file name is not stacked; it is in slot instead.)
         // Ensure pipe cmd on top
         if (nargs == 2 && source == tkpipe) swap();
         struct zfile *zfp = 0;
         if (source == tklt || source == tkpipe) {
-          zfp = setup_file(source == tklt, "r");
-          nargs--;
+          zfp = setup_file(source == tklt, "r", slot);
+          if (slot < 0) nargs--;
         }
         // now cases are:
         // nargs source  TT.stack
@@ -4165,8 +5976,12 @@ static int interpx(int start, int *status)
         force_maybemap_to_map(STKP-1);
         struct zvalue *a = STKP-1;
         struct zvalue *fs = STKP;
-        zmap_delete_map(a->map);
-        k = split(s, a, fs);
+        // An array holding only what split() last put in it is reused
+        int old_cnt = a->map->split_cnt;
+        if (!old_cnt) zmap_delete_map(a->map);
+        k = split(s, a, fs, nargs == 2 && FLAG(csv));
+        if (k < old_cnt) zmap_truncate(a->map, k);
+        a->map->split_cnt = k;
         drop_n(3);
         push_int_val(k);
         break;
@@ -4174,11 +5989,10 @@ static int interpx(int start, int *status)
       case tkmatch:
         nargs = *ip++;
         if (!IS_RX(STKP)) to_str(STKP);
-        regex_t rx_pat, *rxp = &rx_pat;
-        rx_zvalue_compile(&rxp, STKP);
+        struct zregex *zr = rx_zvalue_compile(STKP);
         regoff_t rso = 0, reo = 0;  // shut up warning (may be uninit)
-        k = rx_find(rxp, to_str(STKP-1)->vst->str, &rso, &reo, 0);
-        rx_zvalue_free(rxp, STKP);
+        char *subj = to_str(STKP-1)->vst->str;
+        k = zrx_find(zr, subj, strlen(subj), &rso, &reo, 0);
         // Force these to num before setting.
         to_num(&STACK[RSTART]);
         to_num(&STACK[RLENGTH]);
@@ -4201,16 +6015,23 @@ static int interpx(int start, int *status)
       case tksubstr:
         nargs = *ip++;
         struct zstring *zz = to_str(STKP - nargs + 1)->vst;
-        int nchars = utf8cnt(zz->str, zz->size);  // number of utf8 codepoints
+        size_t nchars = utf8cnt(zz->str, zz->size);  // number of utf8 codepoints
         // Offset of start of string (in chars not bytes); convert 1-based to 0-based
         ssize_t mm = CLAMP(trunc(to_num(STKP - nargs + 2)) - 1, 0, nchars);
         ssize_t nn = nchars - mm;   // max possible substring length (chars)
         if (nargs == 3) nn = CLAMP(trunc(to_num(STKP)), 0, nn);
         mm = bytesinutf8(zz->str, zz->size, mm);
         nn = bytesinutf8(zz->str + mm, zz->size - mm, nn);
-        struct zstring *zzz = new_zstring(zz->str + mm, nn);
-        zstring_release(&(STKP - nargs + 1)->vst);
-        (STKP - nargs + 1)->vst = zzz;
+        // The whole string is the result as is; an unshared one is cut
+        // down in place; else copy the substring.
+        if (!zz->refcnt && (size_t)nn < zz->size) {
+          memmove(zz->str, zz->str + mm, nn);
+          zz->str[zz->size = nn] = 0;
+        } else if ((size_t)nn < zz->size) {
+          struct zstring *zzz = new_zstring(zz->str + mm, nn);
+          zstring_release(&(STKP - nargs + 1)->vst);
+          (STKP - nargs + 1)->vst = zzz;
+        }
         drop_n(nargs - 1);
         break;
 
@@ -4246,7 +6067,7 @@ static int interpx(int start, int *status)
       case tktoupper:
         nargs = *ip++;
         struct zstring *z = to_str(STKP)->vst;
-        unsigned zzlen = z->size + 4; // Allow for expansion
+        size_t zzlen = z->size + 4; // Allow for expansion
         zz = zstring_update(0, zzlen, "", 0);
         char *p = z->str, *e = z->str + z->size, *q = zz->str;
         // Similar logic to toybox strlower(), but fixed.
@@ -4262,9 +6083,10 @@ static int interpx(int start, int *status)
           len = wctoutf8(q, wch);
           q += len;
           // Need realloc here if overflow possible
-          if ((len = q - zz->str) + 4 < (int)zzlen) continue;
-          zz = zstring_update(zz, zzlen = len + 16, "", 0);
-          q = zz->str + len;
+          size_t used = q - zz->str;
+          if (used + 4 < zzlen) continue;
+          zz = zstring_update(zz, zzlen = used + 16, "", 0);
+          q = zz->str + used;
         }
         *q = 0;
         zz->size = q - zz->str;
@@ -4274,21 +6096,22 @@ static int interpx(int start, int *status)
 
       case tklength:
         nargs = *ip++;
+        if (!nargs && TT.rgl.field0_stale) rebuild_field0();
         v = nargs ? STKP : &FIELD[0];
         force_maybemap_to_map(v);
-        if (IS_MAP(v)) k = v->map->count - v->map->deleted;
+        if (IS_MAP(v)) d = v->map->count - v->map->deleted;
+        else if (!nargs && TT.rgl.rec0) d = utf8cnt(TT.rgl.rec0, TT.rgl.rec0len);
         else {
           to_str(v);
-          k = utf8cnt(v->vst->str, v->vst->size);
+          d = utf8cnt(v->vst->str, v->vst->size);
         }
         if (nargs) drop();
-        push_int_val(k);
+        push_int_val(d);
         break;
 
       case tksystem:
         nargs = *ip++;
-        fflush(stdout);
-        fflush(stderr);
+        fflush_all();
         r = system(to_str(STKP)->vst->str);
 #ifdef WEXITSTATUS
         // WEXITSTATUS is in sys/wait.h, but I'm not including that.
@@ -4309,7 +6132,7 @@ static int interpx(int start, int *status)
 
       case tkclose:
         nargs = *ip++;
-        r = close_file(to_str(STKP)->vst->str);
+        r = close_file(to_str(STKP)->vst);
         drop();
         push_int_val(r);
         break;
@@ -4318,7 +6141,7 @@ static int interpx(int start, int *status)
         nargs = *ip++;
         zstring_release(&TT.rgl.zspr);
         TT.rgl.zspr = new_zstring("", 0);
-        varprint(fsprintf, 0, nargs);
+        varprint(nargs);
         drop_n(nargs);
         vv = (struct zvalue)ZVINIT(ZF_STR, 0, TT.rgl.zspr);
         push_val(&vv);
@@ -4391,7 +6214,7 @@ static void init_globals(int optind, int argc, char **argv, char *sepstring,
 {
   // Global variables reside at the bottom of the TT.stack. Start with the awk
   // "special variables":  ARGC, ARGV, CONVFMT, ENVIRON, FILENAME, FNR, FS, NF,
-  // NR, OFMT, OFS, ORS, RLENGTH, RS, RSTART, SUBSEP
+  // NR, OFMT, OFS, ORS, RLENGTH, RS, RSTART, SUBSEP; and FIELDWIDTHS, RECLEN
 
   STACK[CONVFMT] = new_str_val("%.6g");
   // Init ENVIRON map.
@@ -4434,6 +6257,8 @@ static void init_globals(int optind, int argc, char **argv, char *sepstring,
   STACK[RS] = new_str_val("\n");
   STACK[RSTART] = (struct zvalue)ZVINIT(ZF_NUM, 0, 0);
   STACK[SUBSEP] = new_str_val("\034");
+  STACK[FIELDWIDTHS] = new_str_val("");
+  STACK[RECLEN] = (struct zvalue)ZVINIT(ZF_NUM, 0, 0);
 
   // Init program globals.
   //
@@ -4490,23 +6315,23 @@ static void free_literal_regex(void)
 {
   int len = zlist_len(&TT.literals);
   for (int k = 1; k < len; k++)
-    if (IS_RX(&LITERAL[k])) regfree(LITERAL[k].rx);
+    if (IS_RX(&LITERAL[k])) zregfree(LITERAL[k].rx);
 }
 
 static void run(int optind, int argc, char **argv, char *sepstring,
     struct arg_list *assign_args)
 {
   char *printf_fmt_rx = "%[-+ #0']*([*]|[0-9]*)([.]([*]|[0-9]*))?l?[aAdiouxXfFeEgGcs%]";
+  decimal_dot = !strcmp(localeconv()->decimal_point, ".");
   init_globals(optind, argc, argv, sepstring, assign_args);
   TT.cfile = xzalloc(sizeof(struct zfile));
-  xregcomp(&TT.rx_default, "[ \t\n]+", REG_EXTENDED);
-  xregcomp(&TT.rx_last, "[ \t\n]+", REG_EXTENDED);
   xregcomp(&TT.rx_printf_fmt, printf_fmt_rx, REG_EXTENDED);
-  new_file("-", stdin, 'r', 1, 1);
-  new_file("/dev/stdin", stdin, 'r', 1, 1);
-  new_file("/dev/stdout", stdout, 'w', 1, 1);
+  new_std_file("-", stdin, 'r');
+  new_std_file("/dev/stdin", stdin, 'r');
+  new_std_file("/dev/stdout", stdout, 'w');
   TT.zstdout = TT.zfiles;
-  new_file("/dev/stderr", stderr, 'w', 1, 1);
+  new_std_file("/dev/stderr", stderr, 'w');
+  atexit(flush_at_exit);
   seedrand(1);
   int status = -1, r = 0;
   if (TT.cgl.first_begin) r = interp(TT.cgl.first_begin, &status);
@@ -4514,8 +6339,10 @@ static void run(int optind, int argc, char **argv, char *sepstring,
     if (TT.cgl.first_recrule) run_files(&status);
   if (TT.cgl.first_end) r = interp(TT.cgl.first_end, &status);
   regfree(&TT.rx_printf_fmt);
-  regfree(&TT.rx_default);
-  regfree(&TT.rx_last);
+  rx_cache_free();
+  if (TT.rs_mode == RS_REGEX) regfree(&TT.rx_rs_last);
+  zstring_release(&TT.rs_last);
+  zstring_release(&TT.fw_last);
   free_literal_regex();
   close_file(0);    // close all files
   if (status >= 0) awk_exit(status);
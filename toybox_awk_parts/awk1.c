@@ -12,7 +12,7 @@
  *
  * TODO: Lazy field splitting; improve performance; more testing/debugging
 
-USE_AWK(NEWTOY(awk, "F:v*f*bc", TOYFLAG_USR|TOYFLAG_BIN|TOYFLAG_LINEBUF))
+USE_AWK(NEWTOY(awk, "(csv)F:v*f*bc", TOYFLAG_USR|TOYFLAG_BIN|TOYFLAG_LINEBUF))
 
 config AWK
   bool "awk"
@@ -25,6 +25,7 @@ config AWK
       also:
       -b : count bytes, not characters (experimental)
       -c : compile only, do not run
+      --csv : input is CSV (quoted fields; FS and RS ignored)
 */
 
 #define FOR_awk
@@ -87,7 +88,14 @@ GLOBALS(
     union {
       struct zstring *vst;
       struct zmap *map;
-      regex_t *rx;
+      struct zregex {
+        regex_t rx;
+        char *lit;      // text every match contains, or null if none found
+        size_t litlen;
+        char plain;     // the regex is just lit (with ^ and $ as bol and eol)
+        char bol, eol;
+        struct dfa *dfa;  // for match/no match answers, or null; see dfa_match()
+      } *rx;
     } u;
   } nozvalue;   // to shut up compiler warning TODO FIXME
 
@@ -98,7 +106,25 @@ GLOBALS(
     int nfiles;         // num of cmdline data file args processed
     int eof;            // all cmdline files (incl. stdin) read
     char *recptr;
+    char *rec0;         // $0 if still in input buffer; see own_field0()
+    size_t rec0len;
+    struct zfile *rec0_zfp;   // file whose buffer holds rec0
+    char field0_stale;        // a field or NF was set; $0 must be rebuilt
+    struct zstring *rebuild_ofs;  // OFS to rebuild $0 with
     struct zstring *zspr;      // Global to receive sprintf() string value
+    // Where splitting a string into fields stopped, so it can go on later
+    struct split_state {
+      size_t offs;        // offset at which to resume
+      int nf;             // fields split so far
+      int eflag;          // REG_NOTBOL once past the start
+      int r;              // last rx_find_FS() result (nonzero: FS not found)
+      char nl_fs;         // newline also separates fields (RS == "")
+      char csv;           // split as CSV (--csv); see csv_split()
+      char fw;            // split by FIELDWIDTHS; see fw_split()
+      char ascii;         // FIELDWIDTHS: record is ASCII (or -b); cols == bytes
+      char pending;       // more fields remain to be split
+    } split;              // fields of $0 are split on demand
+    struct zstring *split_fs;  // FS in effect when $0 was set
   } rgl;
 
   // Expanding sequential list
@@ -118,14 +144,25 @@ GLOBALS(
   struct zvalue *stackp;  // top of stack ptr
 
   char *pbuf;   // Used for number formatting in num_to_zstring()
-#define RS_MAX  64
-  char rs_last[RS_MAX];
-  regex_t rx_rs_default, rx_rs_last;
-  regex_t rx_default, rx_last, rx_printf_fmt;
+  char fw_mode;             // FIELDWIDTHS was assigned more recently than FS
+  struct zstring *fw_last;  // FIELDWIDTHS value fieldwidths was built for
+  struct zlist fieldwidths; // start column, width (int) per field; fw_prep()
+  struct zstring *rs_last;  // RS value the RS matcher was last built for
+  int rs_mode;              // RS matcher type; see rs_prep()
+  size_t reclen;            // record length if RECLEN > 0; see rs_prep()
+  regex_t rx_rs_last;
+  regex_t rx_printf_fmt;
+  struct rx_cache *rx_cache;     // compiled dynamic regexes; rx_cached()
+  unsigned long rx_cache_tick;
 #define FS_MAX  64
   char fs_last[FS_MAX];
-  char one_char_fs[4];
+  int fs_mode;              // FS matcher type; see fs_prep()
+  char fs_run;              // FS_CLASS FS is [...]+
+  char fs_set[256];         // bytes in FS_CLASS FS
   int nf_internal;  // should match NF
+  int field_max;    // highest constant field number $n in the program
+  char field_dyn;   // program has $expr, not just constant field numbers
+  char nf_ref;      // program refers to NF, so every record is fully split
   char range_sw[64];   // FIXME TODO quick and dirty set of range switches
   int file_cnt, std_file_cnt;
 
@@ -137,9 +174,21 @@ GLOBALS(
     char file_or_pipe;  // 1 if file, 0 if pipe
     char is_tty, is_std_file;
     char eof;
-    int ro, lim, buflen;
+    char is_mapped;   // buf is mmap()ed file, not malloc()ed
+    size_t ro, lim, buflen;
+    size_t ahead;     // mapped file read-ahead requested up to here
+    size_t partial;   // length of last record read if EOF ended it, not RS
     char *buf;
+    char *obuf;       // output buffer, OUTBUF_SIZE bytes
+    size_t olen;      // output bytes pending in obuf
+    int slot;         // index in TT.file_slots; see file_slot()
+    struct zfile *lru_prev, *lru_next;  // open output files; see park_file()
   } *zfiles, *cfile, *zstdout;
+  struct zmap *file_map;    // i/o redirection name -> file table slot
+  struct zlist file_slots;  // name and open zfile (or null) per slot
+  int lru_cnt;              // output files open (not parked)
+  struct zmap *pfmt_map;    // printf format -> index in pfmts
+  struct zlist pfmts;       // compiled printf formats; see get_pfmt()
 )
 
 static void awk_exit(int status)